@@ -0,0 +1,95 @@
+#include "arena.h"
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// blocks double in size up to this cap, so a document only ever owns
+// a handful of them no matter how many tags it has
+#define ARENA_MAX_BLOCK_SIZE (16 * 1024 * 1024)
+
+void arena_init(NBT_Arena *arena, size_t block_size) {
+  arena->head = NULL;
+  arena->block_size = block_size ? block_size : 64 * 1024;
+}
+
+static NBT_ArenaBlock *arena_new_block(NBT_Arena *arena, size_t min_size) {
+  size_t capacity = arena->block_size;
+  if (arena->head != NULL && capacity < ARENA_MAX_BLOCK_SIZE) {
+    arena->block_size *= 2;
+    capacity = arena->block_size;
+  }
+  if (capacity < min_size) {
+    capacity = min_size;
+  }
+
+  NBT_ArenaBlock *block = malloc(sizeof(NBT_ArenaBlock) + capacity);
+  if (block == NULL) {
+    printf("Could not allocate arena block of %zu bytes\n", capacity);
+    return NULL;
+  }
+  block->used = 0;
+  block->capacity = capacity;
+  block->next = arena->head;
+  arena->head = block;
+  return block;
+}
+
+void *arena_alloc(NBT_Arena *arena, size_t size) {
+  const size_t align = alignof(max_align_t);
+  size = (size + align - 1) & ~(align - 1);
+
+  NBT_ArenaBlock *block = arena->head;
+  if (block == NULL || block->capacity - block->used < size) {
+    block = arena_new_block(arena, size);
+    if (block == NULL) {
+      return NULL;
+    }
+  }
+
+  void *ptr = block->data + block->used;
+  block->used += size;
+  return ptr;
+}
+
+// copies len bytes and NUL terminates them, like strndup
+char *arena_strndup(NBT_Arena *arena, const char *src, size_t len) {
+  char *str = arena_alloc(arena, len + 1);
+  if (str == NULL) {
+    return NULL;
+  }
+  memcpy(str, src, len);
+  str[len] = '\0';
+  return str;
+}
+
+void *arena_memdup(NBT_Arena *arena, const void *src, size_t size) {
+  void *dst = arena_alloc(arena, size);
+  if (dst != NULL && size > 0) {
+    memcpy(dst, src, size);
+  }
+  return dst;
+}
+
+// Keeps the newest (and largest) block for reuse and frees the others
+void arena_reset(NBT_Arena *arena) {
+  NBT_ArenaBlock *head = arena->head;
+  if (head == NULL) {
+    return;
+  }
+  arena->head = head->next;
+  arena_release(arena);
+  head->next = NULL;
+  head->used = 0;
+  arena->head = head;
+}
+
+void arena_release(NBT_Arena *arena) {
+  NBT_ArenaBlock *block = arena->head;
+  while (block != NULL) {
+    NBT_ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef NBT_ARENA_H
+#define NBT_ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator backing a whole parsed document. Everything allocated from
+// an arena is released together by arena_release, there is no per-object
+// free.
+typedef struct NBT_ArenaBlock {
+  struct NBT_ArenaBlock *next;
+  size_t used;
+  size_t capacity;
+  _Alignas(max_align_t) unsigned char data[];
+} NBT_ArenaBlock;
+
+typedef struct NBT_Arena {
+  NBT_ArenaBlock *head;
+  size_t block_size;
+} NBT_Arena;
+
+void arena_init(NBT_Arena *arena, size_t block_size);
+void *arena_alloc(NBT_Arena *arena, size_t size);
+char *arena_strndup(NBT_Arena *arena, const char *src, size_t len);
+void *arena_memdup(NBT_Arena *arena, const void *src, size_t size);
+void arena_reset(NBT_Arena *arena);
+void arena_release(NBT_Arena *arena);
+
+#endif // NBT_ARENA_H
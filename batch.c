@@ -0,0 +1,234 @@
+#include "batch.h"
+#include "file.h"
+#include "ordered.h"
+#include <glob.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Files handed to the pool at once. Output of a file is held in memory until
+// every file before it is printed, this bounds how much of it piles up.
+#define BATCH_WINDOW 4096
+
+void file_list_init(NBT_FileList *list) {
+  list->names = NULL;
+  list->count = 0;
+  list->capacity = 0;
+}
+
+static int file_list_push(NBT_FileList *list, const char *name, size_t len) {
+  if (list->count == list->capacity) {
+    long capacity = list->capacity ? list->capacity * 2 : 16;
+    char **names = realloc(list->names, capacity * sizeof(char *));
+    if (names == NULL) {
+      printf("Could not allocate memory for file list\n");
+      return -1;
+    }
+    list->names = names;
+    list->capacity = capacity;
+  }
+  char *copy = strndup(name, len);
+  if (copy == NULL) {
+    printf("Could not allocate memory for file list\n");
+    return -1;
+  }
+  list->names[list->count++] = copy;
+  return 0;
+}
+
+static int file_list_read_stdin(NBT_FileList *list) {
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t len;
+  int result = 0;
+  while ((len = getline(&line, &capacity, stdin)) > 0) {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      len--;
+    }
+    if (len > 0 && file_list_push(list, line, len) != 0) {
+      result = -1;
+      break;
+    }
+  }
+  free(line);
+  return result;
+}
+
+int file_list_add(NBT_FileList *list, const char *arg) {
+  if (strcmp(arg, "-") == 0) {
+    return file_list_read_stdin(list);
+  }
+  if (strpbrk(arg, "*?[") == NULL) {
+    return file_list_push(list, arg, strlen(arg));
+  }
+
+  glob_t matches;
+  int ret = glob(arg, 0, NULL, &matches);
+  if (ret == GLOB_NOMATCH) {
+    printf("No files match %s\n", arg);
+    return -1;
+  }
+  if (ret != 0) {
+    printf("Could not expand %s\n", arg);
+    return -1;
+  }
+  int result = 0;
+  for (size_t i = 0; i < matches.gl_pathc && result == 0; i++) {
+    result = file_list_push(list, matches.gl_pathv[i],
+                            strlen(matches.gl_pathv[i]));
+  }
+  globfree(&matches);
+  return result;
+}
+
+void file_list_free(NBT_FileList *list) {
+  for (long i = 0; i < list->count; i++) {
+    free(list->names[i]);
+  }
+  free(list->names);
+  file_list_init(list);
+}
+
+// zlib state, tree and names reused for every file a worker handles
+typedef struct BatchWorker {
+  NBT_Inflater inflater;
+  NBT_Document *doc;
+  NBT_NameTable names;
+} BatchWorker;
+
+typedef struct BatchScan {
+  const NBT_FileList *files;
+  int flags;
+  BatchFileFn fn;
+  void *ctx;
+  BatchWorker *workers;
+  NBT_OrderedOutput output;
+  // index of the first file of the current window
+  long first;
+  long last;
+  pthread_mutex_t lock;
+  int failed;
+} BatchScan;
+
+static void finish_file(BatchScan *scan, long task, char *text, size_t len,
+                        int failed) {
+  if (failed) {
+    pthread_mutex_lock(&scan->lock);
+    scan->failed++;
+    pthread_mutex_unlock(&scan->lock);
+  }
+  ordered_emit(&scan->output, task, text, len);
+}
+
+// read -> inflate -> parse -> emit of one file. Stages of different files
+// overlap across workers, and the next file of this worker is already being
+// read from disk while this one is parsed.
+static void scan_file(void *ctx, int worker, long task) {
+  BatchScan *scan = ctx;
+  BatchWorker *state = &scan->workers[worker];
+  BatchFile file;
+  file.index = scan->first + task;
+  file.name = scan->files->names[file.index];
+  file.worker = worker;
+  file.doc = NULL;
+
+  if (file.index + 1 < scan->last) {
+    prefetch_file(scan->files->names[file.index + 1]);
+  }
+
+  NBT_Input input;
+  if (open_input(file.name, &state->inflater, &input) != 0) {
+    finish_file(scan, task, NULL, 0, 1);
+    return;
+  }
+  file.data = input.data;
+  file.size = input.size;
+  int parse_flags = scan->flags & ~BATCH_SCAN_FLAGS;
+  if (input.mapped) {
+    parse_flags |= NBT_PARSE_MAPPED;
+  }
+
+  int owned = 0;
+  if (scan->flags & BATCH_SCAN_TREE) {
+    if (state->doc == NULL) {
+      state->doc = create_document(0);
+      if (state->doc != NULL && (scan->flags & BATCH_SCAN_INTERN)) {
+        state->doc->names = &state->names;
+      }
+    }
+    if (state->doc == NULL ||
+        parse_into(state->doc, file.data, file.size, parse_flags) != 0) {
+      close_input(&input);
+      finish_file(scan, task, NULL, 0, 1);
+      return;
+    }
+    file.doc = state->doc;
+    // a zero-copy or lazy document keeps the buffer until it is reused
+    owned = scan->flags & NBT_PARSE_OWNS_BUFFER;
+  }
+
+  NBT_Output out;
+  if (output_init_memory(&out, 0) != 0) {
+    if (!owned) {
+      close_input(&input);
+    }
+    finish_file(scan, task, NULL, 0, 1);
+    return;
+  }
+  file.out = &out;
+  scan->fn(scan->ctx, &file);
+
+  if (!owned) {
+    close_input(&input);
+  }
+  size_t len;
+  char *text = output_take(&out, &len);
+  finish_file(scan, task, text, len, out.failed);
+}
+
+// Runs fn over every file of the list on the pool. Output written to
+// file->out is copied to out in list order. Returns the number of files that
+// could not be read or parsed, -1 if the scan could not start.
+int batch_scan(const NBT_FileList *files, NBT_Pool *pool, int flags,
+               BatchFileFn fn, void *ctx, NBT_Output *out) {
+  BatchScan scan;
+  scan.files = files;
+  scan.flags = flags;
+  scan.fn = fn;
+  scan.ctx = ctx;
+  scan.failed = 0;
+  scan.workers = malloc(pool_size(pool) * sizeof(BatchWorker));
+  if (scan.workers == NULL) {
+    printf("Could not allocate memory for batch scan\n");
+    return -1;
+  }
+  for (int i = 0; i < pool_size(pool); i++) {
+    inflater_init(&scan.workers[i].inflater);
+    scan.workers[i].doc = NULL;
+    name_table_init(&scan.workers[i].names);
+  }
+  pthread_mutex_init(&scan.lock, NULL);
+
+  for (scan.first = 0; scan.first < files->count; scan.first = scan.last) {
+    scan.last = scan.first + BATCH_WINDOW;
+    if (scan.last > files->count) {
+      scan.last = files->count;
+    }
+    if (ordered_init(&scan.output, out, scan.last - scan.first) != 0) {
+      scan.failed = -1;
+      break;
+    }
+    pool_run(pool, scan.last - scan.first, scan_file, &scan);
+    ordered_release(&scan.output);
+  }
+
+  for (int i = 0; i < pool_size(pool); i++) {
+    inflater_end(&scan.workers[i].inflater);
+    free_document(scan.workers[i].doc);
+    name_table_free(&scan.workers[i].names);
+  }
+  pthread_mutex_destroy(&scan.lock);
+  free(scan.workers);
+  return scan.failed;
+}
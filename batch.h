@@ -0,0 +1,48 @@
+#ifndef NBT_BATCH_H
+#define NBT_BATCH_H
+
+#include "output.h"
+#include "parser.h"
+#include "threadpool.h"
+#include <stdint.h>
+
+typedef struct NBT_FileList {
+  char **names;
+  long count;
+  long capacity;
+} NBT_FileList;
+
+void file_list_init(NBT_FileList *list);
+// Adds a file name, every match of a glob pattern, or for "-" every line
+// read from stdin
+int file_list_add(NBT_FileList *list, const char *arg);
+void file_list_free(NBT_FileList *list);
+
+// batch_scan flag, combined with the NBT_ParseFlags: parse every file into
+// file->doc before handing it out
+#define BATCH_SCAN_TREE (1 << 8)
+// with BATCH_SCAN_TREE: intern the tag names of every file a worker parses
+// in one table kept for the whole scan, see names.h
+#define BATCH_SCAN_INTERN (1 << 9)
+#define BATCH_SCAN_FLAGS (BATCH_SCAN_TREE | BATCH_SCAN_INTERN)
+
+// One decompressed file handed to a batch_scan callback. data and doc are
+// only valid until the callback returns, doc is NULL without
+// BATCH_SCAN_TREE. Whatever is written to out ends up in the output of the
+// scan, in the order of the file list.
+typedef struct BatchFile {
+  const char *name;
+  long index;
+  int worker;
+  uint8_t *data;
+  long size;
+  NBT_Document *doc;
+  NBT_Output *out;
+} BatchFile;
+
+typedef void (*BatchFileFn)(void *ctx, BatchFile *file);
+
+int batch_scan(const NBT_FileList *files, NBT_Pool *pool, int flags,
+               BatchFileFn fn, void *ctx, NBT_Output *out);
+
+#endif // NBT_BATCH_H
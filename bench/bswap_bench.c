@@ -0,0 +1,90 @@
+// Times the INT_ARRAY / LONG_ARRAY conversion kernels against each other.
+// Usage: bswap_bench [elements] [rounds]
+
+#include "../bswap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// every kernel has to agree with the scalar one, at every misalignment and
+// for every tail length
+static int check_kernels(const NBT_BswapKernel *kernels, int count) {
+  uint8_t src[8 * 64 + 8];
+  uint64_t expect[64], got[64];
+  for (size_t i = 0; i < sizeof(src); i++) {
+    src[i] = (uint8_t)(i * 131 + 7);
+  }
+  for (int k = 1; k < count; k++) {
+    for (int offset = 0; offset < 8; offset++) {
+      for (long n = 0; n <= 64; n++) {
+        kernels[0].swap64(expect, src + offset, n);
+        kernels[k].swap64(got, src + offset, n);
+        if (memcmp(expect, got, n * 8) != 0) {
+          printf("%s swap64 is wrong for %ld elements\n", kernels[k].name, n);
+          return 0;
+        }
+        kernels[0].swap32((uint32_t *)expect, src + offset, n);
+        kernels[k].swap32((uint32_t *)got, src + offset, n);
+        if (memcmp(expect, got, n * 4) != 0) {
+          printf("%s swap32 is wrong for %ld elements\n", kernels[k].name, n);
+          return 0;
+        }
+      }
+    }
+  }
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  // a 1.18 chunk section: 4096 block states packed into 256-1024 longs,
+  // times 24 sections, is the common case. Default to something larger so
+  // the numbers are not just call overhead.
+  long elements = argc > 1 ? atol(argv[1]) : 1 << 20;
+  int rounds = argc > 2 ? atoi(argv[2]) : 50;
+
+  const NBT_BswapKernel *kernels;
+  int count = bswap_kernels(&kernels);
+  if (!check_kernels(kernels, count)) {
+    return 1;
+  }
+
+  // +1 so the source can be read misaligned, like a payload inside a tag
+  uint8_t *src = malloc(elements * 8 + 1);
+  uint64_t *dst = malloc(elements * 8);
+  if (src == NULL || dst == NULL) {
+    printf("Could not allocate %ld elements\n", elements);
+    return 1;
+  }
+  for (long i = 0; i < elements * 8 + 1; i++) {
+    src[i] = (uint8_t)i;
+  }
+
+  printf("%-8s %12s %12s\n", "kernel", "int MB/s", "long MB/s");
+  for (int k = 0; k < count; k++) {
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+      kernels[k].swap32((uint32_t *)dst, src + 1, elements * 2);
+    }
+    double t32 = now() - start;
+
+    start = now();
+    for (int r = 0; r < rounds; r++) {
+      kernels[k].swap64(dst, src + 1, elements);
+    }
+    double t64 = now() - start;
+
+    double mb = (double)elements * 8 * rounds / (1024 * 1024);
+    printf("%-8s %12.0f %12.0f\n", kernels[k].name, mb / t32, mb / t64);
+  }
+
+  free(src);
+  free(dst);
+  return 0;
+}
@@ -0,0 +1,503 @@
+// Times decompress, parse, query, the flat tree, print, JSON output, SNBT
+// output and input, and free on generated corpora and reports the results as
+// JSON on stdout.
+// Usage: nbt_bench [--shape=NAME] [--size=MB] [--rounds=N] [--zero-copy]
+//                  [--lazy] [--intern]
+// --intern parses into a name table kept for all rounds of a shape, so the
+// query compares names by pointer.
+// Shapes: wide, deep, long_arrays, compound_list, strings. Every shape is
+// generated until its uncompressed size reaches --size (default 16 MB) and
+// measured in a process of its own, so peak RSS belongs to that shape only.
+// Each stage reports its fastest round.
+
+#include "../file.h"
+#include "../flat.h"
+#include "../json.h"
+#include "../output.h"
+#include "../parser.h"
+#include "../printer.h"
+#include "../query.h"
+#include "../snbt.h"
+#include "../writer.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Corpora are written through the event writer, so the generators read like
+// the walk that will decode them
+static NBT_Writer gen;
+
+static void gen_compound(const char *name) {
+  write_handler.begin_compound(&gen, name, name ? strlen(name) : 0);
+}
+
+static void gen_end(void) { write_handler.end_compound(&gen); }
+
+static void gen_list(const char *name, enum TagType type, int32_t length) {
+  write_handler.list_begin(&gen, name, name ? strlen(name) : 0, type,
+                           length);
+}
+
+static void gen_list_end(void) { write_handler.list_end(&gen); }
+
+static void gen_scalar(const char *name, enum TagType type,
+                       union NBT_Value value) {
+  write_handler.scalar(&gen, name, name ? strlen(name) : 0, type, value);
+}
+
+static void gen_int(const char *name, int32_t v) {
+  union NBT_Value value;
+  value.int_value = v;
+  gen_scalar(name, INT, value);
+}
+
+static void gen_string(const char *name, const char *v) {
+  write_handler.string(&gen, name, name ? strlen(name) : 0, v, strlen(v));
+}
+
+// array chunks are passed big-endian, as the walker hands them out
+static void gen_array(const char *name, enum TagType type, int32_t length,
+                      uint64_t seed) {
+  int width = type == INT_ARRAY ? 4 : 8;
+  uint8_t chunk[4096 * 8];
+  write_handler.array_begin(&gen, name, strlen(name), type, length);
+  for (int32_t i = 0; i < length;) {
+    int32_t n = length - i < 4096 ? length - i : 4096;
+    for (int32_t j = 0; j < n; j++) {
+      seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+      for (int b = 0; b < width; b++) {
+        chunk[j * width + b] = seed >> (56 - b * 8);
+      }
+    }
+    write_handler.array_chunk(&gen, chunk, n);
+    i += n;
+  }
+}
+
+static void gen_wide(long target) {
+  char name[32];
+  union NBT_Value value;
+  gen_compound("wide");
+  for (long i = 0; gen.out->len < (size_t)target; i++) {
+    snprintf(name, sizeof(name), "key%ld", i);
+    switch (i % 5) {
+    case 0:
+      gen_int(name, i);
+      break;
+    case 1:
+      value.long_value = i * 1000003;
+      gen_scalar(name, LONG, value);
+      break;
+    case 2:
+      value.double_value = i * 0.25;
+      gen_scalar(name, DOUBLE, value);
+      break;
+    case 3:
+      value.byte_value = i;
+      gen_scalar(name, BYTE, value);
+      break;
+    default:
+      gen_string(name, "minecraft:stone");
+      break;
+    }
+  }
+  gen_end();
+}
+
+static void gen_deep(long target) {
+  gen_compound("deep");
+  while (gen.out->len < (size_t)target) {
+    // the root and this chain stay below the 512 level limit
+    for (int d = 0; d < 500; d++) {
+      gen_compound("level");
+    }
+    gen_int("leaf", 1);
+    for (int d = 0; d < 500; d++) {
+      gen_end();
+    }
+  }
+  gen_end();
+}
+
+static void gen_long_arrays(long target) {
+  char name[32];
+  gen_compound("arrays");
+  for (long i = 0; gen.out->len < (size_t)target; i++) {
+    snprintf(name, sizeof(name), "section%ld", i);
+    gen_array(name, LONG_ARRAY, 65536, i);
+  }
+  gen_end();
+}
+
+// an entity as a chunk stores it
+static void gen_entity(long i) {
+  union NBT_Value value;
+  gen_compound(NULL);
+  gen_string("id", i % 2 ? "minecraft:zombie" : "minecraft:cow");
+  gen_list("Pos", DOUBLE, 3);
+  for (int j = 0; j < 3; j++) {
+    value.double_value = i * 1.5 + j;
+    gen_scalar(NULL, DOUBLE, value);
+  }
+  gen_list_end();
+  value.float_value = 20;
+  gen_scalar("Health", FLOAT, value);
+  value.short_value = 300;
+  gen_scalar("Air", SHORT, value);
+  gen_array("UUID", INT_ARRAY, 4, i);
+  gen_end();
+}
+
+// lists need their length up front, it is estimated from the first element
+static void gen_compound_list(long target) {
+  gen_compound("entities");
+  size_t start = gen.out->len;
+  gen_list("Entities", COMPOUND, 1);
+  size_t header = gen.out->len - start;
+  gen_entity(0);
+  gen_list_end();
+  size_t entity = gen.out->len - start - header;
+  gen.out->len = start;
+
+  int32_t count = target / entity + 1;
+  gen_list("Entities", COMPOUND, count);
+  for (int32_t i = 0; i < count; i++) {
+    gen_entity(i);
+  }
+  gen_list_end();
+  gen_end();
+}
+
+static void gen_strings(long target) {
+  static const char *words[] = {"stone",  "dirt", "oak_planks", "air",
+                                "water",  "sand", "cobblestone", "glass",
+                                "gravel", "ice"};
+  char value[32];
+  // about 10 bytes per string with its length
+  int32_t count = target / 10 + 1;
+  gen_compound("strings");
+  gen_list("names", STRING, count);
+  for (int32_t i = 0; i < count; i++) {
+    snprintf(value, sizeof(value), "%s_%d", words[i % 10], i % 100);
+    gen_string(NULL, value);
+  }
+  gen_list_end();
+  gen_end();
+}
+
+typedef struct Shape {
+  const char *name;
+  void (*generate)(long target);
+  // query run on the parsed tree
+  const char *query;
+} Shape;
+
+static const Shape shapes[] = {
+    {"wide", gen_wide, "key12345"},
+    {"deep", gen_deep, "..leaf"},
+    {"long_arrays", gen_long_arrays, "*"},
+    {"compound_list", gen_compound_list, "Entities[*].Health"},
+    {"strings", gen_strings, "names[*]"},
+};
+
+#define SHAPE_COUNT (int)(sizeof(shapes) / sizeof(shapes[0]))
+
+static long tag_count;
+
+static int count_tag(void *ctx, const char *name, uint16_t name_len) {
+  (void)ctx;
+  (void)name;
+  (void)name_len;
+  tag_count++;
+  return 0;
+}
+
+static int count_scalar(void *ctx, const char *name, uint16_t name_len,
+                        enum TagType type, union NBT_Value value) {
+  (void)type;
+  (void)value;
+  return count_tag(ctx, name, name_len);
+}
+
+static int count_string(void *ctx, const char *name, uint16_t name_len,
+                        const char *value, uint16_t value_len) {
+  (void)value;
+  (void)value_len;
+  return count_tag(ctx, name, name_len);
+}
+
+static int count_array(void *ctx, const char *name, uint16_t name_len,
+                       enum TagType type, int32_t length) {
+  (void)type;
+  (void)length;
+  return count_tag(ctx, name, name_len);
+}
+
+static int count_list(void *ctx, const char *name, uint16_t name_len,
+                      enum TagType type, int32_t length) {
+  (void)type;
+  (void)length;
+  return count_tag(ctx, name, name_len);
+}
+
+static const NBT_Handler counter = {
+    .begin_compound = count_tag,
+    .scalar = count_scalar,
+    .string = count_string,
+    .array_begin = count_array,
+    .list_begin = count_list,
+};
+
+static int count_match(void *ctx, NBT_Tag *tag) {
+  (void)tag;
+  (*(long *)ctx)++;
+  return 0;
+}
+
+static int count_flat_match(void *ctx, const NBT_FlatTree *tree,
+                            uint32_t node) {
+  (void)tree;
+  (void)node;
+  (*(long *)ctx)++;
+  return 0;
+}
+
+enum Stage {
+  DECOMPRESS,
+  PARSE,
+  QUERY,
+  FLAT_PARSE,
+  FLAT_QUERY,
+  PRINT,
+  JSON,
+  SNBT_WRITE,
+  SNBT_PARSE,
+  FREE,
+  STAGES
+};
+
+static const char *stage_names[STAGES] = {
+    "decompress", "parse", "query",      "flat_parse", "flat_query",
+    "print",      "json",  "snbt_write", "snbt_parse", "free"};
+
+// Generates one shape, times every stage and prints its JSON object
+static int run_shape(const Shape *shape, long target, int rounds, int flags,
+                     int intern) {
+  NBT_Output out;
+  if (output_init_memory(&out, target + 1024 * 1024) != 0) {
+    return 1;
+  }
+  init_writer(&gen, &out);
+  shape->generate(target);
+  if (out.failed) {
+    printf("Could not generate %s\n", shape->name);
+    return 1;
+  }
+  size_t size;
+  uint8_t *nbt = (uint8_t *)output_take(&out, &size);
+
+  tag_count = 0;
+  nbt_walk(nbt, size, &counter, NULL);
+
+  uint8_t *gz;
+  long gz_size =
+      compress_buffer(nbt, size, 15 + 16, Z_DEFAULT_COMPRESSION, &gz);
+  char path[] = "/tmp/nbt_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (gz_size < 0 || fd < 0) {
+    printf("Could not write the %s corpus\n", shape->name);
+    return 1;
+  }
+  close(fd);
+  int written = write_file(path, gz, gz_size);
+  free(gz);
+  free(nbt);
+  if (written != 0) {
+    unlink(path);
+    return 1;
+  }
+
+  NBT_Query *query = compile_query(shape->query);
+  int devnull = open("/dev/null", O_WRONLY);
+  if (query == NULL || devnull < 0) {
+    unlink(path);
+    return 1;
+  }
+
+  NBT_NameTable names;
+  name_table_init(&names);
+  double best[STAGES];
+  long matches = 0;
+  for (int s = 0; s < STAGES; s++) {
+    best[s] = 1e30;
+  }
+  for (int r = 0; r < rounds; r++) {
+    double t[STAGES + 1];
+    uint8_t *buffer;
+    t[0] = now();
+    long n = decompress_gzip(path, &buffer);
+    t[1] = now();
+    NBT_Document *doc =
+        n == (long)size
+            ? parse_with_names(buffer, n, flags, intern ? &names : NULL)
+            : NULL;
+    t[2] = now();
+    if (doc == NULL) {
+      printf("Could not read back the %s corpus\n", shape->name);
+      unlink(path);
+      return 1;
+    }
+    matches = 0;
+    query_tree(query, doc, count_match, &matches);
+    t[3] = now();
+    uint8_t *printed = (flags & NBT_PARSE_OWNS_BUFFER) ? doc->buffer : buffer;
+    NBT_FlatTree *flat = flat_parse(printed, n);
+    t[4] = now();
+    if (flat == NULL) {
+      printf("Could not build the flat tree of the %s corpus\n",
+             shape->name);
+      unlink(path);
+      return 1;
+    }
+    long flat_matches = 0;
+    query_flat(query, flat, count_flat_match, &flat_matches);
+    t[5] = now();
+    if (flat_matches != matches) {
+      printf("The flat tree of the %s corpus has %ld matches, not %ld\n",
+             shape->name, flat_matches, matches);
+      unlink(path);
+      return 1;
+    }
+    NBT_Output text;
+    output_init_fd(&text, devnull, 0);
+    print_buffer_to(&text, printed, n);
+    output_release(&text);
+    t[6] = now();
+    NBT_JsonWriter json;
+    output_init_fd(&text, devnull, 0);
+    init_json_writer(&json, &text, NBT_JSON_ARRAYS_PLAIN);
+    nbt_walk(printed, n, &json_handler, &json);
+    output_release(&text);
+    t[7] = now();
+    NBT_Output snbt;
+    size_t snbt_len;
+    output_init_memory(&snbt, n);
+    snbt_write_tag(&snbt, doc, doc->root);
+    char *snbt_text = output_take(&snbt, &snbt_len);
+    t[8] = now();
+    NBT_Document *snbt_doc = parse_snbt(snbt_text, snbt_len);
+    t[9] = now();
+    if (snbt_doc == NULL) {
+      printf("Could not read back the SNBT of the %s corpus\n", shape->name);
+      unlink(path);
+      return 1;
+    }
+    free_document(snbt_doc);
+    free(snbt_text);
+    free_flat_tree(flat);
+    free_document(doc);
+    if (!(flags & NBT_PARSE_OWNS_BUFFER)) {
+      free(buffer);
+    }
+    t[10] = now();
+    for (int s = 0; s < STAGES; s++) {
+      if (t[s + 1] - t[s] < best[s]) {
+        best[s] = t[s + 1] - t[s];
+      }
+    }
+  }
+  unlink(path);
+  close(devnull);
+  free_query(query);
+  name_table_free(&names);
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double mb = size / (1024.0 * 1024.0);
+  printf("    {\"shape\": \"%s\", \"bytes\": %zu, \"compressed_bytes\": %ld, "
+         "\"tags\": %ld, \"rounds\": %d, \"query\": \"%s\", "
+         "\"matches\": %ld,\n     \"stages\": {",
+         shape->name, size, gz_size, tag_count, rounds, shape->query,
+         matches);
+  for (int s = 0; s < STAGES; s++) {
+    printf("%s\n       \"%s\": {\"seconds\": %.6f, \"mb_per_s\": %.1f, "
+           "\"tags_per_s\": %.0f}",
+           s ? "," : "", stage_names[s], best[s], mb / best[s],
+           tag_count / best[s]);
+  }
+  // ru_maxrss is in KiB on Linux
+  printf("},\n     \"peak_rss_kb\": %ld}", usage.ru_maxrss);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  const char *only = NULL;
+  long target = 16L * 1024 * 1024;
+  int rounds = 5;
+  int flags = 0;
+  int intern = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--shape=", 8) == 0) {
+      only = argv[i] + 8;
+    } else if (strncmp(argv[i], "--size=", 7) == 0) {
+      target = (long)(atof(argv[i] + 7) * 1024 * 1024);
+    } else if (strncmp(argv[i], "--rounds=", 9) == 0) {
+      rounds = atoi(argv[i] + 9);
+    } else if (strcmp(argv[i], "--zero-copy") == 0) {
+      flags |= NBT_PARSE_ZERO_COPY;
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      flags |= NBT_PARSE_LAZY;
+    } else if (strcmp(argv[i], "--intern") == 0) {
+      intern = 1;
+    } else {
+      printf("Unknown option %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (rounds < 1) {
+    rounds = 1;
+  }
+  int known = only == NULL;
+  for (int s = 0; s < SHAPE_COUNT; s++) {
+    known |= only != NULL && strcmp(only, shapes[s].name) == 0;
+  }
+  if (!known) {
+    printf("Unknown shape %s\n", only);
+    return 1;
+  }
+
+  printf("{\"flags\": %d, \"intern\": %d, \"results\": [\n", flags, intern);
+  int first = 1, failed = 0;
+  for (int s = 0; s < SHAPE_COUNT; s++) {
+    if (only != NULL && strcmp(only, shapes[s].name) != 0) {
+      continue;
+    }
+    printf("%s", first ? "" : ",\n");
+    first = 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      int result = run_shape(&shapes[s], target, rounds, flags, intern);
+      fflush(stdout);
+      _exit(result);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      failed = 1;
+    }
+  }
+  printf("\n]}\n");
+  return failed;
+}
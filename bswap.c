@@ -0,0 +1,163 @@
+#include "bswap.h"
+#include "cursor.h"
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NBT_BSWAP_X86 1
+#endif
+
+// stores go through memcpy, the encoders below hand in unaligned dst
+static void swap32_scalar(uint32_t *dst, const uint8_t *src, long count) {
+  for (long i = 0; i < count; i++) {
+    uint32_t v = load_be32(src + i * 4);
+    memcpy(dst + i, &v, 4);
+  }
+}
+
+static void swap64_scalar(uint64_t *dst, const uint8_t *src, long count) {
+  for (long i = 0; i < count; i++) {
+    uint64_t v = load_be64(src + i * 8);
+    memcpy(dst + i, &v, 8);
+  }
+}
+
+#ifdef NBT_BSWAP_X86
+
+// SSE2 has no byte shuffle: swap the bytes of every 16-bit word with shifts,
+// then reverse the words of each element
+static inline __m128i swap16_words(__m128i v) {
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2"))) static void
+swap32_sse2(uint32_t *dst, const uint8_t *src, long count) {
+  long i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 4));
+    v = swap16_words(v);
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    _mm_storeu_si128((__m128i *)(dst + i), v);
+  }
+  swap32_scalar(dst + i, src + i * 4, count - i);
+}
+
+__attribute__((target("sse2"))) static void
+swap64_sse2(uint64_t *dst, const uint8_t *src, long count) {
+  long i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 8));
+    v = swap16_words(v);
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    _mm_storeu_si128((__m128i *)(dst + i), v);
+  }
+  swap64_scalar(dst + i, src + i * 8, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+swap32_avx2(uint32_t *dst, const uint8_t *src, long count) {
+  const __m256i mask = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, //
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  long i = 0;
+  // two vectors per iteration keep both load ports busy
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i * 4 + 32));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256((__m256i *)(dst + i + 8),
+                        _mm256_shuffle_epi8(b, mask));
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, mask));
+  }
+  swap32_scalar(dst + i, src + i * 4, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+swap64_avx2(uint64_t *dst, const uint8_t *src, long count) {
+  const __m256i mask = _mm256_setr_epi8(
+      7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, //
+      7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+  long i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + i * 8 + 32));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256((__m256i *)(dst + i + 4),
+                        _mm256_shuffle_epi8(b, mask));
+  }
+  for (; i + 4 <= count; i += 4) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(src + i * 8));
+    _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(a, mask));
+  }
+  swap64_scalar(dst + i, src + i * 8, count - i);
+}
+
+#endif // NBT_BSWAP_X86
+
+static NBT_BswapKernel kernels[3];
+static int kernel_count;
+
+static void init_kernels(void) {
+  int n = 0;
+  kernels[n++] = (NBT_BswapKernel){"scalar", swap32_scalar, swap64_scalar};
+#ifdef NBT_BSWAP_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    kernels[n++] = (NBT_BswapKernel){"sse2", swap32_sse2, swap64_sse2};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    kernels[n++] = (NBT_BswapKernel){"avx2", swap32_avx2, swap64_avx2};
+  }
+#endif
+  kernel_count = n;
+}
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+// the CPU is probed on first use
+static const NBT_BswapKernel *best_kernel(void) {
+  pthread_once(&kernels_once, init_kernels);
+  return &kernels[kernel_count - 1];
+}
+
+// lists of shorts are the only 16-bit payloads and rarely long, the loop is
+// left to the compiler's vectorizer
+void bswap16_array(uint16_t *dst, const uint8_t *src, long count) {
+  for (long i = 0; i < count; i++) {
+    uint16_t v = load_be16(src + i * 2);
+    memcpy(dst + i, &v, 2);
+  }
+}
+
+void bswap32_array(uint32_t *dst, const uint8_t *src, long count) {
+  best_kernel()->swap32(dst, src, count);
+}
+
+void bswap64_array(uint64_t *dst, const uint8_t *src, long count) {
+  best_kernel()->swap64(dst, src, count);
+}
+
+// Reversing the bytes of each element is its own inverse, so encoding runs
+// the same kernels with the roles of the buffers swapped
+void bswap16_encode(uint8_t *dst, const uint16_t *src, long count) {
+  bswap16_array((uint16_t *)dst, (const uint8_t *)src, count);
+}
+
+void bswap32_encode(uint8_t *dst, const uint32_t *src, long count) {
+  best_kernel()->swap32((uint32_t *)dst, (const uint8_t *)src, count);
+}
+
+void bswap64_encode(uint8_t *dst, const uint64_t *src, long count) {
+  best_kernel()->swap64((uint64_t *)dst, (const uint8_t *)src, count);
+}
+
+int bswap_kernels(const NBT_BswapKernel **list) {
+  best_kernel();
+  *list = kernels;
+  return kernel_count;
+}
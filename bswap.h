@@ -0,0 +1,28 @@
+#ifndef NBT_BSWAP_H
+#define NBT_BSWAP_H
+
+#include <stdint.h>
+
+// Bulk conversion of big-endian INT_ARRAY / LONG_ARRAY payloads, and of the
+// elements of packed lists, to host order. src may be unaligned, dst and src
+// must not overlap.
+void bswap16_array(uint16_t *dst, const uint8_t *src, long count);
+void bswap32_array(uint32_t *dst, const uint8_t *src, long count);
+void bswap64_array(uint64_t *dst, const uint8_t *src, long count);
+// The other way, host order elements to big-endian bytes. dst may be
+// unaligned.
+void bswap16_encode(uint8_t *dst, const uint16_t *src, long count);
+void bswap32_encode(uint8_t *dst, const uint32_t *src, long count);
+void bswap64_encode(uint8_t *dst, const uint64_t *src, long count);
+
+typedef struct NBT_BswapKernel {
+  const char *name;
+  void (*swap32)(uint32_t *dst, const uint8_t *src, long count);
+  void (*swap64)(uint64_t *dst, const uint8_t *src, long count);
+} NBT_BswapKernel;
+
+// Lists the kernels this CPU can run, slowest (scalar) first. The last one
+// is what bswap32_array and bswap64_array dispatch to.
+int bswap_kernels(const NBT_BswapKernel **kernels);
+
+#endif // NBT_BSWAP_H
@@ -0,0 +1,109 @@
+#ifndef NBT_CURSOR_H
+#define NBT_CURSOR_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Big-endian loads from unaligned memory. memcpy compiles to a single load
+// and the swap to a single bswap/rev instruction.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define NBT_BE16(x) (x)
+#define NBT_BE32(x) (x)
+#define NBT_BE64(x) (x)
+#else
+#define NBT_BE16(x) __builtin_bswap16(x)
+#define NBT_BE32(x) __builtin_bswap32(x)
+#define NBT_BE64(x) __builtin_bswap64(x)
+#endif
+
+static inline uint16_t load_be16(const uint8_t *p) {
+  uint16_t v;
+  memcpy(&v, p, 2);
+  return NBT_BE16(v);
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return NBT_BE32(v);
+}
+
+static inline uint64_t load_be64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return NBT_BE64(v);
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v) {
+  v = NBT_BE32(v);
+  memcpy(p, &v, 4);
+}
+
+enum NBT_CursorStatus {
+  NBT_CURSOR_OK = 0,
+  NBT_CURSOR_TRUNCATED = -1,
+};
+
+// Read position in a buffer of NBT. The readers below do not check bounds,
+// a caller reserves all fixed-size fields of a tag with one cursor_need and
+// then reads them unchecked.
+typedef struct NBT_Cursor {
+  const uint8_t *start;
+  const uint8_t *pos;
+  const uint8_t *end;
+} NBT_Cursor;
+
+static inline void cursor_init(NBT_Cursor *c, const uint8_t *buf,
+                               long size) {
+  c->start = buf;
+  c->pos = buf;
+  c->end = buf + size;
+}
+
+static inline long cursor_offset(const NBT_Cursor *c) {
+  return c->pos - c->start;
+}
+
+static inline long cursor_remaining(const NBT_Cursor *c) {
+  return c->end - c->pos;
+}
+
+static inline int cursor_need(const NBT_Cursor *c, long n) {
+  return cursor_remaining(c) >= n ? NBT_CURSOR_OK : NBT_CURSOR_TRUNCATED;
+}
+
+static inline const uint8_t *cursor_skip(NBT_Cursor *c, long n) {
+  const uint8_t *p = c->pos;
+  c->pos += n;
+  return p;
+}
+
+static inline uint8_t cursor_u8(NBT_Cursor *c) { return *c->pos++; }
+
+static inline uint16_t cursor_u16(NBT_Cursor *c) {
+  return load_be16(cursor_skip(c, 2));
+}
+
+static inline uint32_t cursor_u32(NBT_Cursor *c) {
+  return load_be32(cursor_skip(c, 4));
+}
+
+static inline uint64_t cursor_u64(NBT_Cursor *c) {
+  return load_be64(cursor_skip(c, 8));
+}
+
+static inline float cursor_f32(NBT_Cursor *c) {
+  uint32_t bits = cursor_u32(c);
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+static inline double cursor_f64(NBT_Cursor *c) {
+  uint64_t bits = cursor_u64(c);
+  double value;
+  memcpy(&value, &bits, 8);
+  return value;
+}
+
+#endif // NBT_CURSOR_H
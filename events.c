@@ -0,0 +1,556 @@
+#include "events.h"
+#include "cursor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A compound or list the walk is inside of. The decoder keeps them on a
+// stack of its own instead of recursing, see walk_tree.
+typedef struct WalkFrame {
+  // elements of a list still to come, -1 for a compound
+  int32_t remaining;
+  uint8_t element_type;
+} WalkFrame;
+
+#define WALK_LOUD (NBT_MAX_DEPTH + 1)
+
+// The walker reads either a complete buffer or a window that is refilled
+// from an NBT_ReadFn. The name of the tag being decoded is pinned so that a
+// refill in the middle of its header does not drop it from the window.
+typedef struct Walker {
+  NBT_Cursor cur;
+  // start of the window, the cursor's start
+  uint8_t *buf;
+  // offset of the pinned name in buf, -1 when there is none
+  long pin;
+  // stream offset of buf[0], for error messages
+  long base;
+  long capacity;
+  NBT_ReadFn read;
+  void *source;
+  // open compounds and lists, frames[1] to frames[depth]
+  int depth;
+  WalkFrame frames[NBT_MAX_DEPTH + 1];
+  // depth of the outermost frame being skipped, WALK_LOUD when none is
+  int quiet;
+  const NBT_Handler *handler;
+  void *ctx;
+} Walker;
+
+// bytes of a payload in front of any variable-length data, reserved together
+// with the name of the tag
+static const uint8_t payload_fixed_size[] = {
+    [BYTE] = 1,   [SHORT] = 2,      [INT] = 4,  [LONG] = 8,
+    [FLOAT] = 4,  [DOUBLE] = 8,     [STRING] = 2, [BYTE_ARRAY] = 4,
+    [LIST] = 5,   [INT_ARRAY] = 4,  [LONG_ARRAY] = 4,
+};
+
+static long payload_fixed(uint8_t type) {
+  return type <= LONG_ARRAY ? payload_fixed_size[type] : 0;
+}
+
+static long walker_offset(const Walker *w) {
+  return w->base + cursor_offset(&w->cur);
+}
+
+// makes sure n bytes can be read at the cursor, pulling more of the stream
+// into the window if needed
+static int walker_fill(Walker *w, long n) {
+  if (cursor_need(&w->cur, n) == NBT_CURSOR_OK) {
+    return 1;
+  }
+  if (w->read == NULL) {
+    return 0;
+  }
+
+  long pos = cursor_offset(&w->cur);
+  long size = w->cur.end - w->buf;
+  long keep = w->pin >= 0 ? w->pin : pos;
+  if (keep > 0) {
+    memmove(w->buf, w->buf + keep, size - keep);
+    size -= keep;
+    pos -= keep;
+    w->base += keep;
+    if (w->pin >= 0) {
+      w->pin -= keep;
+    }
+  }
+
+  while (pos + n > size && size < w->capacity) {
+    long got = w->read(w->source, w->buf + size, w->capacity - size);
+    if (got <= 0) {
+      break;
+    }
+    size += got;
+  }
+  w->cur.pos = w->buf + pos;
+  w->cur.end = w->buf + size;
+  return pos + n <= size;
+}
+
+static int walker_need(Walker *w, long n) {
+  if (walker_fill(w, n)) {
+    return 1;
+  }
+  printf("Unexpected end of data at position %ld\n", walker_offset(w));
+  return 0;
+}
+
+static const char *pinned_name(Walker *w) {
+  return w->pin < 0 ? NULL : (const char *)&w->buf[w->pin];
+}
+
+// Reads the type and name of the next tag and reserves the fixed part of its
+// payload, so decoding a scalar tag costs two bounds checks. Returns 0 at an
+// END tag, 1 for a tag and NBT_WALK_ERROR on truncated input.
+static int walk_tag_header(Walker *w, uint8_t *type, uint16_t *name_len) {
+  if (!walker_fill(w, 3)) {
+    // only a closing END can sit in the last two bytes of the input
+    if (!walker_need(w, 1) || (*w->cur.pos != END && !walker_need(w, 3))) {
+      return NBT_WALK_ERROR;
+    }
+  }
+  *type = cursor_u8(&w->cur);
+  if (*type == END) {
+    return 0;
+  }
+  *name_len = cursor_u16(&w->cur);
+  w->pin = cursor_offset(&w->cur);
+  if (!walker_need(w, *name_len + payload_fixed(*type))) {
+    return NBT_WALK_ERROR;
+  }
+  cursor_skip(&w->cur, *name_len);
+  return 1;
+}
+
+// Consumes n bytes without looking at them, a stream is read through the
+// window as often as needed
+static int walker_discard(Walker *w, long n) {
+  while (cursor_remaining(&w->cur) < n) {
+    long available = cursor_remaining(&w->cur);
+    cursor_skip(&w->cur, available);
+    n -= available;
+    if (!walker_need(w, 1)) {
+      return 0;
+    }
+  }
+  cursor_skip(&w->cur, n);
+  return 1;
+}
+
+static int walker_error_depth(Walker *w) {
+  printf("Nesting deeper than %d at position %ld\n", NBT_MAX_DEPTH,
+         walker_offset(w));
+  return NBT_WALK_ERROR;
+}
+
+// Opens a compound (length -1) or list, the walk loop reads its contents
+// next
+static void walker_push(Walker *w, uint8_t element_type, int32_t length) {
+  WalkFrame *frame = &w->frames[++w->depth];
+  frame->element_type = element_type;
+  frame->remaining = length;
+}
+
+// Payload decoders, one per tag type. Each is called with the fixed part of
+// the payload reserved, and returns once the payload is consumed or, for a
+// compound or list, once its frame is pushed.
+typedef int (*PayloadFn)(Walker *w, uint8_t type, uint16_t name_len);
+
+static int emit_scalar(Walker *w, uint8_t type, uint16_t name_len,
+                       union NBT_Value value) {
+  const NBT_Handler *h = w->handler;
+  if (h->scalar &&
+      h->scalar(w->ctx, pinned_name(w), name_len, type, value)) {
+    return NBT_WALK_STOPPED;
+  }
+  w->pin = -1;
+  return NBT_WALK_DONE;
+}
+
+static int walk_byte(Walker *w, uint8_t type, uint16_t name_len) {
+  union NBT_Value value;
+  value.byte_value = (int8_t)cursor_u8(&w->cur);
+  return emit_scalar(w, type, name_len, value);
+}
+
+static int walk_short(Walker *w, uint8_t type, uint16_t name_len) {
+  union NBT_Value value;
+  value.short_value = (int16_t)cursor_u16(&w->cur);
+  return emit_scalar(w, type, name_len, value);
+}
+
+static int walk_int(Walker *w, uint8_t type, uint16_t name_len) {
+  union NBT_Value value;
+  value.int_value = (int32_t)cursor_u32(&w->cur);
+  return emit_scalar(w, type, name_len, value);
+}
+
+static int walk_long(Walker *w, uint8_t type, uint16_t name_len) {
+  union NBT_Value value;
+  value.long_value = (int64_t)cursor_u64(&w->cur);
+  return emit_scalar(w, type, name_len, value);
+}
+
+static int walk_float(Walker *w, uint8_t type, uint16_t name_len) {
+  union NBT_Value value;
+  value.float_value = cursor_f32(&w->cur);
+  return emit_scalar(w, type, name_len, value);
+}
+
+static int walk_double(Walker *w, uint8_t type, uint16_t name_len) {
+  union NBT_Value value;
+  value.double_value = cursor_f64(&w->cur);
+  return emit_scalar(w, type, name_len, value);
+}
+
+static int walk_string(Walker *w, uint8_t type, uint16_t name_len) {
+  const NBT_Handler *h = w->handler;
+  (void)type;
+  uint16_t len = cursor_u16(&w->cur);
+  if (!walker_need(w, len)) {
+    return NBT_WALK_ERROR;
+  }
+  const char *str = (const char *)cursor_skip(&w->cur, len);
+  if (h->string && h->string(w->ctx, pinned_name(w), name_len, str, len)) {
+    return NBT_WALK_STOPPED;
+  }
+  w->pin = -1;
+  return NBT_WALK_DONE;
+}
+
+// Hands out length elements of the given width through chunk. A whole
+// buffer does it in one chunk, a stream in as many as its window needs.
+static int walk_chunks(Walker *w, int32_t length, long width,
+                       int (*chunk)(void *, const uint8_t *, int32_t)) {
+  int32_t remaining = length;
+  while (remaining > 0) {
+    if (!walker_need(w, width)) {
+      return NBT_WALK_ERROR;
+    }
+    long available = cursor_remaining(&w->cur) / width;
+    int32_t count = available < remaining ? (int32_t)available : remaining;
+    const uint8_t *data = cursor_skip(&w->cur, count * width);
+    remaining -= count;
+    if (chunk && chunk(w->ctx, data, count)) {
+      return NBT_WALK_STOPPED;
+    }
+  }
+  return NBT_WALK_DONE;
+}
+
+static int walk_array(Walker *w, uint8_t type, uint16_t name_len) {
+  const NBT_Handler *h = w->handler;
+  int32_t length = (int32_t)cursor_u32(&w->cur);
+  if (length < 0) {
+    printf("Negative array length %d at position %ld\n", length,
+           walker_offset(w));
+    return NBT_WALK_ERROR;
+  }
+  long width = type == BYTE_ARRAY ? 1 : type == INT_ARRAY ? 4 : 8;
+  // a whole buffer has to hold the payload before a handler sizes anything
+  // after the length
+  if (w->read == NULL && !walker_need(w, length * width)) {
+    return NBT_WALK_ERROR;
+  }
+  int begin = h->array_begin ? h->array_begin(w->ctx, pinned_name(w),
+                                              name_len, type, length)
+                             : NBT_CONTINUE;
+  if (begin != NBT_CONTINUE && begin != NBT_SKIP) {
+    return NBT_WALK_STOPPED;
+  }
+  w->pin = -1;
+
+  if (begin == NBT_SKIP) {
+    return walker_discard(w, length * width) ? NBT_WALK_DONE
+                                             : NBT_WALK_ERROR;
+  }
+  return walk_chunks(w, length, width, h->array_chunk);
+}
+
+static int walk_list(Walker *w, uint8_t type, uint16_t name_len) {
+  const NBT_Handler *h = w->handler;
+  (void)type;
+  uint8_t element_type = cursor_u8(&w->cur);
+  int32_t length = (int32_t)cursor_u32(&w->cur);
+  if (length < 0) {
+    printf("Negative list length %d at position %ld\n", length,
+           walker_offset(w));
+    return NBT_WALK_ERROR;
+  }
+  if (w->depth == NBT_MAX_DEPTH) {
+    return walker_error_depth(w);
+  }
+
+  int begin = h->list_begin ? h->list_begin(w->ctx, pinned_name(w),
+                                            name_len, element_type, length)
+                            : NBT_CONTINUE;
+  if (begin != NBT_CONTINUE && begin != NBT_SKIP) {
+    return NBT_WALK_STOPPED;
+  }
+  w->pin = -1;
+  int numbers = element_type >= BYTE && element_type <= DOUBLE;
+  if (begin == NBT_SKIP && numbers) {
+    return walker_discard(w, length * payload_fixed(element_type))
+               ? NBT_WALK_DONE
+               : NBT_WALK_ERROR;
+  }
+  if (begin == NBT_CONTINUE && numbers && h->list_chunk) {
+    int result = walk_chunks(w, length, payload_fixed(element_type),
+                             h->list_chunk);
+    if (result != NBT_WALK_DONE) {
+      return result;
+    }
+    length = 0;
+  }
+  walker_push(w, element_type, length);
+  if (begin == NBT_SKIP) {
+    w->quiet = w->depth;
+  }
+  return NBT_WALK_DONE;
+}
+
+static int walk_compound(Walker *w, uint8_t type, uint16_t name_len) {
+  const NBT_Handler *h = w->handler;
+  (void)type;
+  if (w->depth == NBT_MAX_DEPTH) {
+    return walker_error_depth(w);
+  }
+  int begin = h->begin_compound
+                  ? h->begin_compound(w->ctx, pinned_name(w), name_len)
+                  : NBT_CONTINUE;
+  if (begin != NBT_CONTINUE && begin != NBT_SKIP) {
+    return NBT_WALK_STOPPED;
+  }
+  w->pin = -1;
+  walker_push(w, END, -1);
+  if (begin == NBT_SKIP) {
+    w->quiet = w->depth;
+  }
+  return NBT_WALK_DONE;
+}
+
+static const PayloadFn walk_payload[] = {
+    [BYTE] = walk_byte,          [SHORT] = walk_short,
+    [INT] = walk_int,            [LONG] = walk_long,
+    [FLOAT] = walk_float,        [DOUBLE] = walk_double,
+    [BYTE_ARRAY] = walk_array,   [STRING] = walk_string,
+    [LIST] = walk_list,          [COMPOUND] = walk_compound,
+    [INT_ARRAY] = walk_array,    [LONG_ARRAY] = walk_array,
+};
+
+// Skipped payloads are passed over without decoding them or calling the
+// handler. Scalars, arrays and lists of numbers are jumped over by length
+// times element width, only compounds and other lists open a frame.
+
+static int skip_fixed(Walker *w, uint8_t type, uint16_t name_len) {
+  (void)name_len;
+  cursor_skip(&w->cur, payload_fixed(type));
+  w->pin = -1;
+  return NBT_WALK_DONE;
+}
+
+static int skip_string(Walker *w, uint8_t type, uint16_t name_len) {
+  (void)type;
+  (void)name_len;
+  w->pin = -1;
+  return walker_discard(w, cursor_u16(&w->cur)) ? NBT_WALK_DONE
+                                                : NBT_WALK_ERROR;
+}
+
+static int skip_array(Walker *w, uint8_t type, uint16_t name_len) {
+  (void)name_len;
+  int32_t length = (int32_t)cursor_u32(&w->cur);
+  if (length < 0) {
+    printf("Negative array length %d at position %ld\n", length,
+           walker_offset(w));
+    return NBT_WALK_ERROR;
+  }
+  w->pin = -1;
+  long width = type == BYTE_ARRAY ? 1 : type == INT_ARRAY ? 4 : 8;
+  return walker_discard(w, length * width) ? NBT_WALK_DONE
+                                           : NBT_WALK_ERROR;
+}
+
+static int skip_list(Walker *w, uint8_t type, uint16_t name_len) {
+  (void)type;
+  (void)name_len;
+  uint8_t element_type = cursor_u8(&w->cur);
+  int32_t length = (int32_t)cursor_u32(&w->cur);
+  if (length < 0) {
+    printf("Negative list length %d at position %ld\n", length,
+           walker_offset(w));
+    return NBT_WALK_ERROR;
+  }
+  if (w->depth == NBT_MAX_DEPTH) {
+    return walker_error_depth(w);
+  }
+  w->pin = -1;
+  if (element_type >= BYTE && element_type <= DOUBLE) {
+    return walker_discard(w, length * payload_fixed(element_type))
+               ? NBT_WALK_DONE
+               : NBT_WALK_ERROR;
+  }
+  walker_push(w, element_type, length);
+  return NBT_WALK_DONE;
+}
+
+static int skip_compound(Walker *w, uint8_t type, uint16_t name_len) {
+  (void)type;
+  (void)name_len;
+  if (w->depth == NBT_MAX_DEPTH) {
+    return walker_error_depth(w);
+  }
+  w->pin = -1;
+  walker_push(w, END, -1);
+  return NBT_WALK_DONE;
+}
+
+static const PayloadFn skip_payload[] = {
+    [BYTE] = skip_fixed,         [SHORT] = skip_fixed,
+    [INT] = skip_fixed,          [LONG] = skip_fixed,
+    [FLOAT] = skip_fixed,        [DOUBLE] = skip_fixed,
+    [BYTE_ARRAY] = skip_array,   [STRING] = skip_string,
+    [LIST] = skip_list,          [COMPOUND] = skip_compound,
+    [INT_ARRAY] = skip_array,    [LONG_ARRAY] = skip_array,
+};
+
+// The payload of a tag at the cursor, decoded or skipped depending on
+// whether it sits in a skipped compound or list
+static int walk_tag(Walker *w, uint8_t type, uint16_t name_len) {
+  const PayloadFn *table =
+      w->depth >= w->quiet ? skip_payload : walk_payload;
+  if (type > LONG_ARRAY || table[type] == NULL) {
+    printf("Unknown tag type %d at position %ld (0x%lx)\n", type,
+           walker_offset(w), walker_offset(w));
+    return NBT_WALK_ERROR;
+  }
+  return table[type](w, type, name_len);
+}
+
+// Closes the innermost frame, skipped ones get no end_compound or list_end
+static int walker_pop(Walker *w) {
+  const NBT_Handler *h = w->handler;
+  int compound = w->frames[w->depth].remaining < 0;
+  int skipped = w->depth >= w->quiet;
+  if (w->depth == w->quiet) {
+    w->quiet = WALK_LOUD;
+  }
+  w->depth--;
+  if (skipped) {
+    return NBT_WALK_DONE;
+  }
+  if (compound ? h->end_compound && h->end_compound(w->ctx)
+               : h->list_end && h->list_end(w->ctx)) {
+    return NBT_WALK_STOPPED;
+  }
+  return NBT_WALK_DONE;
+}
+
+// Walks the tag whose header was just read, with everything nested in it.
+// Nesting is kept on the walker's frame stack rather than the call stack,
+// every tag costs one pass through this loop and one table dispatch.
+static int walk_tree(Walker *w, uint8_t type, uint16_t name_len) {
+  int base = w->depth;
+  int result = walk_tag(w, type, name_len);
+  while (result == NBT_WALK_DONE && w->depth > base) {
+    WalkFrame *frame = &w->frames[w->depth];
+    if (frame->remaining < 0) {
+      int header = walk_tag_header(w, &type, &name_len);
+      if (header == NBT_WALK_ERROR) {
+        return NBT_WALK_ERROR;
+      }
+      if (header == 0) {
+        result = walker_pop(w);
+        continue;
+      }
+    } else {
+      if (frame->remaining == 0) {
+        result = walker_pop(w);
+        continue;
+      }
+      frame->remaining--;
+      type = frame->element_type;
+      name_len = 0;
+      if (!walker_need(w, payload_fixed(type))) {
+        return NBT_WALK_ERROR;
+      }
+    }
+    result = walk_tag(w, type, name_len);
+  }
+  return result;
+}
+
+static int walk_root_tags(Walker *w) {
+  while (walker_fill(w, 1)) {
+    uint8_t type;
+    uint16_t name_len;
+    int header = walk_tag_header(w, &type, &name_len);
+    if (header == NBT_WALK_ERROR) {
+      return NBT_WALK_ERROR;
+    }
+    // END bytes between root tags carry no payload
+    if (header == 0) {
+      continue;
+    }
+    int result = walk_tree(w, type, name_len);
+    if (result != NBT_WALK_DONE) {
+      return result;
+    }
+  }
+  return NBT_WALK_DONE;
+}
+
+static void init_walker(Walker *w, uint8_t *buf, long size, long capacity,
+                        const NBT_Handler *handler, void *ctx) {
+  cursor_init(&w->cur, buf, size);
+  w->buf = buf;
+  w->pin = -1;
+  w->base = 0;
+  w->capacity = capacity;
+  w->read = NULL;
+  w->source = NULL;
+  w->depth = 0;
+  w->quiet = WALK_LOUD;
+  w->handler = handler;
+  w->ctx = ctx;
+}
+
+int nbt_walk(uint8_t *buffer, long size, const NBT_Handler *handler,
+             void *ctx) {
+  Walker w;
+  init_walker(&w, buffer, size, size, handler, ctx);
+  return walk_root_tags(&w);
+}
+
+long nbt_skip(uint8_t *buffer, long size, long offset, enum TagType type) {
+  Walker w;
+  init_walker(&w, buffer, size, size, NULL, NULL);
+  cursor_skip(&w.cur, offset);
+  w.quiet = 0;
+  if (!walker_need(&w, payload_fixed(type)) ||
+      walk_tree(&w, type, 0) != NBT_WALK_DONE) {
+    return -1;
+  }
+  return cursor_offset(&w.cur);
+}
+
+int nbt_walk_stream(NBT_ReadFn read, void *source, long window,
+                    const NBT_Handler *handler, void *ctx) {
+  if (window < NBT_MIN_WINDOW) {
+    window = NBT_MIN_WINDOW;
+  }
+  uint8_t *buf = malloc(window);
+  if (buf == NULL) {
+    printf("Could not allocate stream window of %ld bytes\n", window);
+    return NBT_WALK_ERROR;
+  }
+
+  Walker w;
+  init_walker(&w, buf, 0, window, handler, ctx);
+  w.read = read;
+  w.source = source;
+  int result = walk_root_tags(&w);
+  free(buf);
+  return result;
+}
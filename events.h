@@ -0,0 +1,66 @@
+#ifndef NBT_EVENTS_H
+#define NBT_EVENTS_H
+
+#include "parser.h"
+#include <stdint.h>
+
+// NBT allows at most 512 levels of nesting
+#define NBT_MAX_DEPTH 512
+
+// Smallest stream window, a tag name and a string value of up to 64 KiB each
+// have to fit in it at the same time
+#define NBT_MIN_WINDOW (132 * 1024)
+
+// Callbacks driven by nbt_walk. Every callback is optional. Names point into
+// the walked buffer and are not NUL terminated, list elements have no name
+// (NULL, 0). When walking a stream, names, strings and array chunks are only
+// valid until the callback returns. Callbacks return one of
+// NBT_CallbackResult, anything nonzero other than NBT_SKIP stops the walk.
+enum NBT_CallbackResult {
+  NBT_CONTINUE = 0,
+  NBT_STOP = 1,
+  // from begin_compound, array_begin and list_begin: pass over the payload
+  // of the tag without any further callbacks, including its end_compound or
+  // list_end
+  NBT_SKIP = 2,
+};
+
+typedef struct NBT_Handler {
+  int (*begin_compound)(void *ctx, const char *name, uint16_t name_len);
+  int (*end_compound)(void *ctx);
+  // BYTE, SHORT, INT, LONG, FLOAT and DOUBLE tags
+  int (*scalar)(void *ctx, const char *name, uint16_t name_len,
+                enum TagType type, union NBT_Value value);
+  int (*string)(void *ctx, const char *name, uint16_t name_len,
+                const char *value, uint16_t value_len);
+  // BYTE_ARRAY, INT_ARRAY and LONG_ARRAY payloads are handed out as raw
+  // big-endian elements, possibly split over several chunks
+  int (*array_begin)(void *ctx, const char *name, uint16_t name_len,
+                     enum TagType type, int32_t length);
+  int (*array_chunk)(void *ctx, const uint8_t *data, int32_t count);
+  int (*list_begin)(void *ctx, const char *name, uint16_t name_len,
+                    enum TagType element_type, int32_t length);
+  // When set, the elements of a list of BYTE to DOUBLE are handed out like
+  // an array payload, as raw big-endian chunks between list_begin and
+  // list_end, instead of one scalar call each
+  int (*list_chunk)(void *ctx, const uint8_t *data, int32_t count);
+  int (*list_end)(void *ctx);
+} NBT_Handler;
+
+enum NBT_WalkResult {
+  NBT_WALK_ERROR = -1,
+  NBT_WALK_DONE = 0,
+  NBT_WALK_STOPPED = 1,
+};
+
+int nbt_walk(uint8_t *buffer, long size, const NBT_Handler *handler,
+             void *ctx);
+// Offset just past the payload of a tag of the given type that starts at
+// offset, found without decoding it. -1 if the payload is malformed.
+long nbt_skip(uint8_t *buffer, long size, long offset, enum TagType type);
+// Walks a stream through a window of the given size, so memory use does not
+// depend on the size of the input
+int nbt_walk_stream(NBT_ReadFn read, void *source, long window,
+                    const NBT_Handler *handler, void *ctx);
+
+#endif // NBT_EVENTS_H
@@ -1,81 +1,307 @@
 
+#include "file.h"
+#include "snbt.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <zlib.h>
 
+// Raw contents of a file in a compressed format or SNBT to raw NBT in a new
+// heap buffer, on inflater when it is not NULL
+static long decode_contents(NBT_Inflater *inflater, const uint8_t *src,
+                            long src_len, enum NBT_Format format,
+                            uint8_t **out_buffer) {
+  if (format == NBT_FORMAT_SNBT) {
+    return snbt_to_nbt((const char *)src, src_len, out_buffer);
+  }
+  NBT_Inflater local;
+  if (inflater == NULL) {
+    inflater_init(&local);
+  }
+  long size = inflater_run(inflater ? inflater : &local, src, src_len,
+                           format == NBT_FORMAT_GZIP ? 15 + 16 : 15,
+                           out_buffer);
+  if (inflater == NULL) {
+    inflater_end(&local);
+  }
+  return size;
+}
+
 long decompress_gzip(const char *filename, uint8_t **out_buffer) {
-  gzFile gz = gzopen(filename, "rb");
-  if (gz == NULL) {
-    printf("Could not open gzip file: %s\n", filename);
+  uint8_t *raw;
+  long raw_size = read_file(filename, &raw);
+  if (raw_size < 0) {
     return -1;
   }
+  enum NBT_Format format = sniff_format(raw, raw_size);
+  if (format == NBT_FORMAT_RAW) {
+    *out_buffer = raw;
+    return raw_size;
+  }
+  long size = decode_contents(NULL, raw, raw_size, format, out_buffer);
+  free(raw);
+  return size;
+}
 
-  // Arbitrarily choosen buffer size
-  size_t buffer_size = 20 * 1024;
-  size_t total_size = 0;
-  uint8_t *buffer = malloc(buffer_size);
+void inflater_init(NBT_Inflater *inflater) {
+  memset(&inflater->zs, 0, sizeof(inflater->zs));
+  inflater->window_bits = 0;
+}
 
+// Inflates an in-memory gzip or zlib stream. window_bits is passed to
+// inflateInit2, 15 + 32 detects either header. The zlib state is set up on
+// first use and only reset afterwards.
+long inflater_run(NBT_Inflater *inflater, const uint8_t *src, long src_len,
+                  int window_bits, uint8_t **out_buffer) {
+  z_stream *zs = &inflater->zs;
+  int ret;
+  if (inflater->window_bits == 0) {
+    ret = inflateInit2(zs, window_bits);
+  } else if (inflater->window_bits == window_bits) {
+    ret = inflateReset(zs);
+  } else {
+    ret = inflateReset2(zs, window_bits);
+  }
+  if (ret != Z_OK) {
+    printf("Could not initialize zlib: %s\n", zs->msg ? zs->msg : "");
+    inflater_end(inflater);
+    return -1;
+  }
+  inflater->window_bits = window_bits;
+
+  // NBT usually compresses 4-10x, start there and double. A gzip stream
+  // ends with the size of its contents modulo 4 GiB, which usually lets the
+  // buffer be allocated once at its final size.
+  size_t buffer_size = src_len * 4 > 4096 ? src_len * 4 : 4096;
+  if (window_bits > 15 && src_len >= 18 && src[0] == 0x1f && src[1] == 0x8b) {
+    const uint8_t *trailer = src + src_len - 4;
+    uint32_t isize = trailer[0] | trailer[1] << 8 | trailer[2] << 16 |
+                     (uint32_t)trailer[3] << 24;
+    // deflate expands by at most 1032x, a larger value does not belong to
+    // this stream
+    if (isize > 0 && (long)(isize / 1032) <= src_len) {
+      buffer_size = isize;
+    }
+  }
+  uint8_t *buffer = malloc(buffer_size);
   if (buffer == NULL) {
-    printf("Initial memory allocation for file buffer failed\n");
-    gzclose(gz);
+    printf("Memory allocation for decompressed buffer failed\n");
     return -1;
   }
 
-  while (1) {
-    if (total_size == buffer_size) {
+  zs->next_in = (Bytef *)src;
+  zs->avail_in = src_len;
+  size_t filled = 0;
+  do {
+    if (filled == buffer_size) {
       buffer_size *= 2;
       uint8_t *new_buffer = realloc(buffer, buffer_size);
       if (new_buffer == NULL) {
-        printf("Memory reallocation for file buffer failed\n");
+        printf("Memory reallocation for decompressed buffer failed\n");
         free(buffer);
-        gzclose(gz);
         return -1;
       }
       buffer = new_buffer;
     }
+    zs->next_out = buffer + filled;
+    zs->avail_out = buffer_size - filled;
+    ret = inflate(zs, Z_NO_FLUSH);
+    filled = buffer_size - zs->avail_out;
+    // like gzread, gzip members that follow the first one are appended to
+    // it, anything else after the stream is ignored
+    if (ret == Z_STREAM_END && window_bits > 15 && zs->avail_in >= 2 &&
+        zs->next_in[0] == 0x1f && zs->next_in[1] == 0x8b) {
+      ret = inflateReset(zs);
+    }
+  } while (ret == Z_OK);
+
+  if (ret != Z_STREAM_END) {
+    printf("Decompression error: %s\n", zs->msg ? zs->msg : "truncated data");
+    free(buffer);
+    return -1;
+  }
+
+  *out_buffer = buffer;
+  return filled;
+}
 
-    int bytes_read = gzread(gz, buffer + total_size, buffer_size - total_size);
+void inflater_end(NBT_Inflater *inflater) {
+  if (inflater->window_bits != 0) {
+    inflateEnd(&inflater->zs);
+  }
+  inflater->window_bits = 0;
+}
 
-    if (bytes_read < 0) {
-      int err;
-      const char *error_string = gzerror(gz, &err);
-      printf("Error reading gzip file: %s\n", error_string);
+long decompress_buffer(const uint8_t *src, long src_len, int window_bits,
+                       uint8_t **out_buffer) {
+  NBT_Inflater inflater;
+  inflater_init(&inflater);
+  long size = inflater_run(&inflater, src, src_len, window_bits, out_buffer);
+  inflater_end(&inflater);
+  return size;
+}
+
+static long read_fd(int fd, const char *filename, long size,
+                    uint8_t **out_buffer) {
+  uint8_t *buffer = malloc(size > 0 ? size : 1);
+  if (buffer == NULL) {
+    printf("Memory allocation for file buffer failed\n");
+    return -1;
+  }
+  long total = 0;
+  while (total < size) {
+    ssize_t n = read(fd, buffer + total, size - total);
+    if (n < 0) {
+      printf("Error reading file: %s\n", filename);
       free(buffer);
-      gzclose(gz);
       return -1;
     }
-
-    if (bytes_read == 0) {
-      // End of file
+    if (n == 0) {
       break;
     }
+    total += n;
+  }
+  *out_buffer = buffer;
+  return total;
+}
 
-    total_size += bytes_read;
+static int open_file(const char *filename, struct stat *st) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("Could not open file: %s\n", filename);
+    return -1;
+  }
+  if (fstat(fd, st) != 0) {
+    printf("Could not stat file: %s\n", filename);
+    close(fd);
+    return -1;
   }
+  return fd;
+}
 
-  // Check for errors during decompression
-  int err;
-  const char *error_string = gzerror(gz, &err);
-  if (err != Z_OK && err != Z_STREAM_END) {
-    printf("Decompression error: %s\n", error_string);
-    free(buffer);
-    gzclose(gz);
+// Reads a whole file into a new heap buffer and returns its size, or -1
+long read_file(const char *filename, uint8_t **out_buffer) {
+  struct stat st;
+  int fd = open_file(filename, &st);
+  if (fd < 0) {
     return -1;
   }
+  long size = read_fd(fd, filename, st.st_size, out_buffer);
+  close(fd);
+  return size;
+}
+
+enum NBT_Format sniff_format(const uint8_t *data, long size) {
+  if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b) {
+    return NBT_FORMAT_GZIP;
+  }
+  // 78 is deflate with a 32 KiB window, and no tag type
+  if (size >= 2 && data[0] == 0x78 && (data[0] << 8 | data[1]) % 31 == 0) {
+    return NBT_FORMAT_ZLIB;
+  }
+  // neither is a tag type
+  if (size >= 1 && (data[0] == '{' || data[0] == '[')) {
+    return NBT_FORMAT_SNBT;
+  }
+  return NBT_FORMAT_RAW;
+}
 
-  gzclose(gz);
+// Smaller files are read instead of mapped. For them a mapping costs more
+// than the copy, and unmapping interrupts every other thread of the process,
+// which hurts batch workers that go through thousands of small files.
+#define NBT_MAP_MIN (1024 * 1024)
 
-  // Shrink buffer to actual size
-  if (total_size < buffer_size) {
-    uint8_t *final_buffer = realloc(buffer, total_size);
-    if (final_buffer != NULL) {
-      buffer = final_buffer;
-    }
-    // If realloc fails, we'll just use the larger buffer
+int open_input(const char *filename, NBT_Inflater *inflater,
+               NBT_Input *input) {
+  struct stat st;
+  int fd = open_file(filename, &st);
+  if (fd < 0) {
+    return -1;
+  }
+  uint8_t *contents = MAP_FAILED;
+  long size = st.st_size;
+  if (size >= NBT_MAP_MIN) {
+    contents =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  }
+  int mapped = contents != MAP_FAILED;
+  if (!mapped) {
+    size = read_fd(fd, filename, size, &contents);
+  }
+  close(fd);
+  if (size < 0) {
+    return -1;
   }
 
-  *out_buffer = buffer;
-  return total_size;
+  enum NBT_Format format = sniff_format(contents, size);
+  if (format == NBT_FORMAT_RAW) {
+    input->data = contents;
+    input->size = size;
+    input->mapped = mapped;
+    return 0;
+  }
+  // compressed contents and text are read once front to back
+  if (mapped) {
+    madvise(contents, size, MADV_SEQUENTIAL);
+  }
+  input->size = decode_contents(inflater, contents, size, format, &input->data);
+  input->mapped = 0;
+  if (mapped) {
+    munmap(contents, size);
+  } else {
+    free(contents);
+  }
+  return input->size < 0 ? -1 : 0;
+}
+
+void close_input(NBT_Input *input) {
+  if (input->mapped) {
+    munmap(input->data, input->size);
+  } else {
+    free(input->data);
+  }
+  input->data = NULL;
+}
+
+// Asks the kernel to start reading a file we are about to open, so the disk
+// works while the current file is parsed
+void prefetch_file(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+  close(fd);
+}
+
+gzFile open_gzip_stream(const char *filename) {
+  gzFile gz = gzopen(filename, "rb");
+  if (gz == NULL) {
+    printf("Could not open gzip file: %s\n", filename);
+    return NULL;
+  }
+  // the default 8 KiB input buffer means a read syscall every few tags
+  gzbuffer(gz, 128 * 1024);
+  return gz;
+}
+
+// NBT_ReadFn over a gzFile, uncompressed files are passed through by gzread
+long read_gzip(void *source, uint8_t *dst, long len) {
+  gzFile gz = source;
+  int bytes_read = gzread(gz, dst, len > INT_MAX ? INT_MAX : (unsigned)len);
+  if (bytes_read < 0) {
+    int err;
+    const char *error_string = gzerror(gz, &err);
+    printf("Error reading gzip file: %s\n", error_string);
+    return -1;
+  }
+  return bytes_read;
 }
 
 long get_file_size(FILE *f) {
@@ -90,10 +316,273 @@ long get_file_size(FILE *f) {
   return res;
 }
 
-// int write_file_gzip(const char *filename) {
-//   gzFile gz = gzopen(filename, "wb");
-//   if (gz == NULL) {
-//     printf("Could not open file: %s\n", filename);
-//     return -1;
-//   }
-// }
+// Deflates a whole buffer in one call into a buffer of deflateBound size.
+// window_bits is passed to deflateInit2, 15 + 16 writes a gzip stream and
+// 15 a zlib one.
+long compress_buffer(const uint8_t *src, long src_len, int window_bits,
+                     int level, uint8_t **out_buffer) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    printf("Could not initialize zlib: %s\n", zs.msg ? zs.msg : "");
+    return -1;
+  }
+  // deflateBound leaves out the gzip header and trailer
+  size_t buffer_size = deflateBound(&zs, src_len) + 18;
+  uint8_t *buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    printf("Memory allocation for compressed buffer failed\n");
+    deflateEnd(&zs);
+    return -1;
+  }
+  zs.next_in = (Bytef *)src;
+  zs.avail_in = src_len;
+  zs.next_out = buffer;
+  zs.avail_out = buffer_size;
+  int ret = deflate(&zs, Z_FINISH);
+  if (ret != Z_STREAM_END) {
+    printf("Compression error: %s\n", zs.msg ? zs.msg : "output too large");
+    free(buffer);
+    deflateEnd(&zs);
+    return -1;
+  }
+  deflateEnd(&zs);
+  *out_buffer = buffer;
+  return zs.total_out;
+}
+
+// Parallel deflate in the manner of pigz. The input is cut into blocks that
+// are compressed on the pool as raw deflate streams, each primed with the
+// 32 KiB of input in front of it so matches can still reach back across the
+// cut. Every block but the last ends with a sync flush on a byte boundary,
+// so the blocks simply concatenate, and the checksums of the blocks are
+// combined for the trailer.
+#define DEFLATE_BLOCK (256 * 1024)
+#define DEFLATE_DICT (32 * 1024)
+
+typedef struct DeflateBlock {
+  uint8_t *data;
+  long size;
+  uint32_t check;
+} DeflateBlock;
+
+typedef struct DeflateJob {
+  const uint8_t *src;
+  long src_len;
+  int level;
+  int gzip;
+  DeflateBlock *blocks;
+  long count;
+} DeflateJob;
+
+static void deflate_block(void *ctx, int worker, long task) {
+  (void)worker;
+  DeflateJob *job = ctx;
+  DeflateBlock *block = &job->blocks[task];
+  long start = task * DEFLATE_BLOCK;
+  long len = job->src_len - start < DEFLATE_BLOCK ? job->src_len - start
+                                                  : DEFLATE_BLOCK;
+  const uint8_t *src = job->src + start;
+  int last = task == job->count - 1;
+  block->size = -1;
+  block->check = job->gzip ? crc32(0, src, len) : adler32(1, src, len);
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, job->level, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return;
+  }
+  if (start > 0) {
+    long dict = start < DEFLATE_DICT ? start : DEFLATE_DICT;
+    deflateSetDictionary(&zs, src - dict, dict);
+  }
+  // a sync flush adds an empty stored block of 5 bytes
+  size_t buffer_size = deflateBound(&zs, len) + 16;
+  block->data = malloc(buffer_size);
+  if (block->data == NULL) {
+    deflateEnd(&zs);
+    return;
+  }
+  zs.next_in = (Bytef *)src;
+  zs.avail_in = len;
+  zs.next_out = block->data;
+  zs.avail_out = buffer_size;
+  int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+  if (last ? ret == Z_STREAM_END : ret == Z_OK && zs.avail_out > 0) {
+    block->size = zs.total_out;
+  }
+  deflateEnd(&zs);
+}
+
+// compress_buffer on the pool, with the same window_bits and output. Small
+// inputs are compressed on the calling thread.
+long compress_parallel(NBT_Pool *pool, const uint8_t *src, long src_len,
+                       int window_bits, int level, uint8_t **out_buffer) {
+  long count = (src_len + DEFLATE_BLOCK - 1) / DEFLATE_BLOCK;
+  if (pool == NULL || pool_size(pool) < 2 || count < 2) {
+    return compress_buffer(src, src_len, window_bits, level, out_buffer);
+  }
+
+  DeflateJob job;
+  job.src = src;
+  job.src_len = src_len;
+  job.level = level;
+  job.gzip = window_bits > 15;
+  job.count = count;
+  job.blocks = calloc(count, sizeof(DeflateBlock));
+  if (job.blocks == NULL) {
+    printf("Memory allocation for compressed blocks failed\n");
+    return -1;
+  }
+  pool_run(pool, count, deflate_block, &job);
+
+  size_t total = 10 + 8;
+  uint32_t check = job.gzip ? crc32(0, NULL, 0) : adler32(0, NULL, 0);
+  long failed = 0;
+  for (long i = 0; i < count; i++) {
+    DeflateBlock *block = &job.blocks[i];
+    long len = i < count - 1 ? DEFLATE_BLOCK : src_len - i * DEFLATE_BLOCK;
+    failed += block->size < 0;
+    total += block->size;
+    check = job.gzip ? crc32_combine(check, block->check, len)
+                     : adler32_combine(check, block->check, len);
+  }
+
+  uint8_t *buffer = failed ? NULL : malloc(total);
+  if (buffer != NULL) {
+    uint8_t *dst = buffer;
+    if (job.gzip) {
+      // no name, no mtime, unix
+      static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+      memcpy(dst, header, 10);
+      dst += 10;
+    } else {
+      *dst++ = 0x78;
+      *dst++ = 0x9c;
+    }
+    for (long i = 0; i < count; i++) {
+      memcpy(dst, job.blocks[i].data, job.blocks[i].size);
+      dst += job.blocks[i].size;
+    }
+    if (job.gzip) {
+      uint32_t size = src_len;
+      for (int i = 0; i < 4; i++) {
+        *dst++ = check >> (i * 8);
+      }
+      for (int i = 0; i < 4; i++) {
+        *dst++ = size >> (i * 8);
+      }
+    } else {
+      for (int i = 3; i >= 0; i--) {
+        *dst++ = check >> (i * 8);
+      }
+    }
+    total = dst - buffer;
+  } else {
+    printf("Compression error: %s\n",
+           failed ? "could not compress a block" : "out of memory");
+  }
+
+  for (long i = 0; i < count; i++) {
+    free(job.blocks[i].data);
+  }
+  free(job.blocks);
+  if (buffer == NULL) {
+    return -1;
+  }
+  *out_buffer = buffer;
+  return total;
+}
+
+// Replaces the contents of a file, returns 0 or -1
+static int write_fd(int fd, const char *filename, const uint8_t *data,
+                    long size) {
+  long total = 0;
+  while (total < size) {
+    ssize_t n = write(fd, data + total, size - total);
+    if (n < 0) {
+      printf("Error writing file: %s\n", filename);
+      close(fd);
+      return -1;
+    }
+    total += n;
+  }
+  if (close(fd) != 0) {
+    printf("Error writing file: %s\n", filename);
+    return -1;
+  }
+  return 0;
+}
+
+// A regular file is replaced through a temporary one next to it, so an
+// input that is still mapped keeps its old pages and a failed write leaves
+// the file as it was. The new file keeps the permissions of the one it
+// replaces, a file that did not exist gets the usual 0666 less the umask.
+// Devices and pipes are written directly.
+int write_file(const char *filename, const uint8_t *data, long size) {
+  struct stat st;
+  int exists = stat(filename, &st) == 0;
+  if (exists && !S_ISREG(st.st_mode)) {
+    int fd = open(filename, O_WRONLY | O_TRUNC);
+    if (fd < 0) {
+      printf("Could not open file for writing: %s\n", filename);
+      return -1;
+    }
+    return write_fd(fd, filename, data, size);
+  }
+
+  size_t len = strlen(filename);
+  char *tmp = malloc(len + sizeof(".XXXXXX"));
+  if (tmp == NULL) {
+    printf("Could not allocate memory for file name\n");
+    return -1;
+  }
+  memcpy(tmp, filename, len);
+  memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    printf("Could not open file for writing: %s\n", filename);
+    free(tmp);
+    return -1;
+  }
+  // mkstemp creates the file as 0600
+  mode_t mode;
+  if (exists) {
+    mode = st.st_mode & 07777;
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+  }
+  int result;
+  if (fchmod(fd, mode) != 0) {
+    printf("Could not set the permissions of file: %s\n", filename);
+    close(fd);
+    result = -1;
+  } else {
+    result = write_fd(fd, filename, data, size);
+  }
+  if (result == 0 && rename(tmp, filename) != 0) {
+    printf("Could not replace file: %s\n", filename);
+    result = -1;
+  }
+  if (result != 0) {
+    unlink(tmp);
+  }
+  free(tmp);
+  return result;
+}
+
+int write_file_gzip(const char *filename, const uint8_t *data, long size) {
+  uint8_t *compressed;
+  long compressed_size =
+      compress_buffer(data, size, 15 + 16, Z_DEFAULT_COMPRESSION, &compressed);
+  if (compressed_size < 0) {
+    return -1;
+  }
+  int result = write_file(filename, compressed, compressed_size);
+  free(compressed);
+  return result;
+}
@@ -1,8 +1,68 @@
-#include <_types/_uint8_t.h>
+#ifndef NBT_FILE_H
+#define NBT_FILE_H
+
+#include "threadpool.h"
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <zlib.h>
 
+// Reads a gzip, zlib or raw NBT file into a new heap buffer holding the raw
+// NBT and returns its size, or -1
 long decompress_gzip(const char *filename, uint8_t **out_buffer);
-bool write_file_gzip(gzFile file, voidpc buf, unsigned len);
+// Inflate state kept across calls, so a worker handling many small inputs
+// does not set up zlib for each of them
+typedef struct NBT_Inflater {
+  z_stream zs;
+  // of the current zlib state, 0 before the first use
+  int window_bits;
+} NBT_Inflater;
+
+void inflater_init(NBT_Inflater *inflater);
+long inflater_run(NBT_Inflater *inflater, const uint8_t *src, long src_len,
+                  int window_bits, uint8_t **out_buffer);
+void inflater_end(NBT_Inflater *inflater);
+
+long decompress_buffer(const uint8_t *src, long src_len, int window_bits,
+                       uint8_t **out_buffer);
+
+enum NBT_Format {
+  NBT_FORMAT_RAW,
+  NBT_FORMAT_GZIP,
+  NBT_FORMAT_ZLIB,
+  NBT_FORMAT_SNBT,
+};
+
+// Tells the formats apart by their first bytes: 1f 8b for gzip, 78 and a
+// valid header check for zlib, { or [ for SNBT text, anything else is taken
+// as raw NBT
+enum NBT_Format sniff_format(const uint8_t *data, long size);
+
+// The raw NBT of an input file. Large raw files are mapped and used in
+// place, with private pages so edits of a lazy document never reach the
+// file. Everything else ends up in a heap buffer.
+typedef struct NBT_Input {
+  uint8_t *data;
+  long size;
+  // data is a mapping of the whole file, see NBT_PARSE_MAPPED
+  int mapped;
+} NBT_Input;
+
+// Opens filename and inflates it if it is compressed, on inflater when it
+// is not NULL, and converts SNBT text. Returns 0, or -1 after printing why.
+int open_input(const char *filename, NBT_Inflater *inflater,
+               NBT_Input *input);
+void close_input(NBT_Input *input);
+long read_file(const char *filename, uint8_t **out_buffer);
+void prefetch_file(const char *filename);
+gzFile open_gzip_stream(const char *filename);
+long read_gzip(void *source, uint8_t *dst, long len);
+long compress_buffer(const uint8_t *src, long src_len, int window_bits,
+                     int level, uint8_t **out_buffer);
+long compress_parallel(NBT_Pool *pool, const uint8_t *src, long src_len,
+                       int window_bits, int level, uint8_t **out_buffer);
+int write_file(const char *filename, const uint8_t *data, long size);
+int write_file_gzip(const char *filename, const uint8_t *data, long size);
 long get_file_size(FILE *f);
+
+#endif // NBT_FILE_H
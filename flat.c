@@ -0,0 +1,301 @@
+#include "flat.h"
+#include "bswap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reserves n bytes at the end of the pool, aligned to align. Returns their
+// offset, -1 if the pool cannot grow.
+static int64_t pool_alloc(NBT_FlatPool *pool, size_t n, size_t align) {
+  size_t offset = (pool->len + align - 1) & ~(align - 1);
+  if (offset + n > UINT32_MAX) {
+    printf("Flat tree pool exceeds 4 GiB\n");
+    return -1;
+  }
+  if (offset + n > pool->capacity) {
+    size_t capacity = pool->capacity ? pool->capacity : 1024;
+    while (capacity < offset + n) {
+      capacity *= 2;
+    }
+    char *data = realloc(pool->data, capacity);
+    if (data == NULL) {
+      printf("Could not allocate memory for flat tree pool\n");
+      return -1;
+    }
+    pool->data = data;
+    pool->capacity = capacity;
+  }
+  pool->len = offset + n;
+  return offset;
+}
+
+// Nodes are appended in the order the walk reports them, which is pre-order.
+// Indices stay valid while the node array grows.
+typedef struct FlatBuilder {
+  NBT_FlatTree *tree;
+  uint32_t open[NBT_MAX_DEPTH + 1];
+  // last child of every open container, level 0 links the root tags
+  uint32_t last[NBT_MAX_DEPTH + 2];
+  int depth;
+  // array node whose payload is still arriving
+  uint32_t array;
+  int32_t array_filled;
+} FlatBuilder;
+
+static NBT_FlatNode *flat_add(FlatBuilder *b, enum TagType type,
+                              const char *name, uint16_t name_len) {
+  NBT_FlatTree *tree = b->tree;
+  if (tree->count == tree->capacity) {
+    if (tree->capacity >= UINT32_MAX / 2) {
+      printf("Flat tree has too many tags\n");
+      return NULL;
+    }
+    uint32_t capacity = tree->capacity ? tree->capacity * 2 : 64;
+    NBT_FlatNode *nodes =
+        realloc(tree->nodes, capacity * sizeof(NBT_FlatNode));
+    if (nodes == NULL) {
+      printf("Could not allocate memory for flat tree\n");
+      return NULL;
+    }
+    tree->nodes = nodes;
+    tree->capacity = capacity;
+  }
+
+  // every list element shares the empty name at offset 0
+  int64_t name_offset = 0;
+  if (name_len > 0) {
+    name_offset = pool_alloc(&tree->names, name_len + 1, 1);
+    if (name_offset < 0) {
+      return NULL;
+    }
+    memcpy(tree->names.data + name_offset, name, name_len);
+    tree->names.data[name_offset + name_len] = '\0';
+  }
+
+  uint32_t index = tree->count++;
+  NBT_FlatNode *node = &tree->nodes[index];
+  node->type = type;
+  node->element_type = END;
+  node->name_length = name_len;
+  node->name = name_offset;
+  node->parent = b->depth ? b->open[b->depth - 1] : NBT_FLAT_NONE;
+  node->next = NBT_FLAT_NONE;
+  if (b->last[b->depth] != NBT_FLAT_NONE) {
+    tree->nodes[b->last[b->depth]].next = index;
+  }
+  b->last[b->depth] = index;
+  if (b->depth) {
+    tree->nodes[b->open[b->depth - 1]].value.count++;
+  }
+  return node;
+}
+
+static void flat_open(FlatBuilder *b, NBT_FlatNode *node) {
+  node->value.count = 0;
+  b->open[b->depth++] = node - b->tree->nodes;
+  b->last[b->depth] = NBT_FLAT_NONE;
+}
+
+static int flat_begin_compound(void *ctx, const char *name,
+                               uint16_t name_len) {
+  FlatBuilder *b = ctx;
+  NBT_FlatNode *node = flat_add(b, COMPOUND, name, name_len);
+  if (node == NULL) {
+    return 1;
+  }
+  flat_open(b, node);
+  return 0;
+}
+
+static int flat_end(void *ctx) {
+  FlatBuilder *b = ctx;
+  b->depth--;
+  return 0;
+}
+
+static int flat_scalar(void *ctx, const char *name, uint16_t name_len,
+                       enum TagType type, union NBT_Value value) {
+  NBT_FlatNode *node = flat_add(ctx, type, name, name_len);
+  if (node == NULL) {
+    return 1;
+  }
+  switch (type) {
+  case BYTE:
+    node->value.byte_value = value.byte_value;
+    break;
+  case SHORT:
+    node->value.short_value = value.short_value;
+    break;
+  case INT:
+    node->value.int_value = value.int_value;
+    break;
+  case LONG:
+    node->value.long_value = value.long_value;
+    break;
+  case FLOAT:
+    node->value.float_value = value.float_value;
+    break;
+  default:
+    node->value.double_value = value.double_value;
+    break;
+  }
+  return 0;
+}
+
+static int flat_string(void *ctx, const char *name, uint16_t name_len,
+                       const char *value, uint16_t value_len) {
+  FlatBuilder *b = ctx;
+  NBT_FlatNode *node = flat_add(b, STRING, name, name_len);
+  if (node == NULL) {
+    return 1;
+  }
+  int64_t offset = pool_alloc(&b->tree->payload, value_len + 1, 1);
+  if (offset < 0) {
+    return 1;
+  }
+  memcpy(b->tree->payload.data + offset, value, value_len);
+  b->tree->payload.data[offset + value_len] = '\0';
+  node->value.data.offset = offset;
+  node->value.data.length = value_len;
+  return 0;
+}
+
+static int flat_array_begin(void *ctx, const char *name, uint16_t name_len,
+                            enum TagType type, int32_t length) {
+  FlatBuilder *b = ctx;
+  NBT_FlatNode *node = flat_add(b, type, name, name_len);
+  if (node == NULL) {
+    return 1;
+  }
+  size_t width = type == BYTE_ARRAY ? 1 : type == INT_ARRAY ? 4 : 8;
+  int64_t offset = pool_alloc(&b->tree->payload, length * width, width);
+  if (offset < 0) {
+    return 1;
+  }
+  node->value.data.offset = offset;
+  node->value.data.length = length;
+  b->array = node - b->tree->nodes;
+  b->array_filled = 0;
+  return 0;
+}
+
+static int flat_array_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  FlatBuilder *b = ctx;
+  NBT_FlatNode *node = &b->tree->nodes[b->array];
+  char *dst = b->tree->payload.data + node->value.data.offset;
+
+  switch (node->type) {
+  case BYTE_ARRAY:
+    memcpy(dst + b->array_filled, data, count);
+    break;
+  case INT_ARRAY:
+    bswap32_array((uint32_t *)dst + b->array_filled, data, count);
+    break;
+  default:
+    bswap64_array((uint64_t *)dst + b->array_filled, data, count);
+    break;
+  }
+  b->array_filled += count;
+  return 0;
+}
+
+static int flat_list_begin(void *ctx, const char *name, uint16_t name_len,
+                           enum TagType element_type, int32_t length) {
+  (void)length;
+  FlatBuilder *b = ctx;
+  NBT_FlatNode *node = flat_add(b, LIST, name, name_len);
+  if (node == NULL) {
+    return 1;
+  }
+  node->element_type = element_type;
+  flat_open(b, node);
+  return 0;
+}
+
+static const NBT_Handler flat_builder = {
+    .begin_compound = flat_begin_compound,
+    .end_compound = flat_end,
+    .scalar = flat_scalar,
+    .string = flat_string,
+    .array_begin = flat_array_begin,
+    .array_chunk = flat_array_chunk,
+    .list_begin = flat_list_begin,
+    .list_end = flat_end,
+};
+
+static NBT_FlatTree *create_flat_tree(FlatBuilder *b) {
+  NBT_FlatTree *tree = calloc(1, sizeof(NBT_FlatTree));
+  if (tree == NULL) {
+    printf("Could not allocate memory for flat tree\n");
+    return NULL;
+  }
+  // offset 0 of the name pool is the empty name of list elements
+  if (pool_alloc(&tree->names, 1, 1) < 0) {
+    free(tree);
+    return NULL;
+  }
+  tree->names.data[0] = '\0';
+  b->tree = tree;
+  b->depth = 0;
+  b->last[0] = NBT_FLAT_NONE;
+  return tree;
+}
+
+// The tree copies everything it needs, buffer stays with the caller
+NBT_FlatTree *flat_parse(uint8_t *buffer, long size) {
+  FlatBuilder builder;
+  NBT_FlatTree *tree = create_flat_tree(&builder);
+  if (tree == NULL) {
+    return NULL;
+  }
+  if (nbt_walk(buffer, size, &flat_builder, &builder) != NBT_WALK_DONE) {
+    free_flat_tree(tree);
+    return NULL;
+  }
+  return tree;
+}
+
+NBT_FlatTree *flat_parse_stream(NBT_ReadFn read, void *source, long window) {
+  FlatBuilder builder;
+  NBT_FlatTree *tree = create_flat_tree(&builder);
+  if (tree == NULL) {
+    return NULL;
+  }
+  if (nbt_walk_stream(read, source, window, &flat_builder, &builder) !=
+      NBT_WALK_DONE) {
+    free_flat_tree(tree);
+    return NULL;
+  }
+  return tree;
+}
+
+void free_flat_tree(NBT_FlatTree *tree) {
+  if (tree == NULL) {
+    return;
+  }
+  free(tree->nodes);
+  free(tree->names.data);
+  free(tree->payload.data);
+  free(tree);
+}
+
+size_t flat_tree_size(const NBT_FlatTree *tree) {
+  return sizeof(NBT_FlatTree) + tree->capacity * sizeof(NBT_FlatNode) +
+         tree->names.capacity + tree->payload.capacity;
+}
+
+uint32_t flat_child(const NBT_FlatTree *tree, uint32_t node, const char *name,
+                    size_t name_len) {
+  if (tree->nodes[node].type != COMPOUND) {
+    return NBT_FLAT_NONE;
+  }
+  for (uint32_t i = flat_first_child(tree, node); i != NBT_FLAT_NONE;
+       i = tree->nodes[i].next) {
+    const NBT_FlatNode *child = &tree->nodes[i];
+    if (child->name_length == name_len &&
+        memcmp(flat_name(tree, child), name, name_len) == 0) {
+      return i;
+    }
+  }
+  return NBT_FLAT_NONE;
+}
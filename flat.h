@@ -0,0 +1,88 @@
+#ifndef NBT_FLAT_H
+#define NBT_FLAT_H
+
+#include "events.h"
+#include "parser.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact alternative to the NBT_Tag tree. All tags live in one array in
+// pre-order, so the children of a compound or list follow it directly and
+// walking a subtree is a forward scan. Names and the payloads of strings and
+// arrays are kept in two separate pools, a node refers to them by offset.
+
+#define NBT_FLAT_NONE UINT32_MAX
+
+typedef struct NBT_FlatNode {
+  uint8_t type;
+  // element type of a list
+  uint8_t element_type;
+  uint16_t name_length;
+  // offset of the NUL terminated name in the name pool
+  uint32_t name;
+  // NBT_FLAT_NONE for root tags
+  uint32_t parent;
+  // next child of the same parent, NBT_FLAT_NONE for the last one
+  uint32_t next;
+  union {
+    int8_t byte_value;
+    int16_t short_value;
+    int32_t int_value;
+    int64_t long_value;
+    float float_value;
+    double double_value;
+    // strings and arrays: offset in the payload pool and number of elements,
+    // arrays are stored in host byte order
+    struct {
+      uint32_t offset;
+      int32_t length;
+    } data;
+    // compounds and lists: number of children
+    int32_t count;
+  } value;
+} NBT_FlatNode;
+
+// offsets into a pool are 32 bits, so a pool holds at most 4 GiB
+typedef struct NBT_FlatPool {
+  char *data;
+  size_t len;
+  size_t capacity;
+} NBT_FlatPool;
+
+typedef struct NBT_FlatTree {
+  NBT_FlatNode *nodes;
+  uint32_t count;
+  uint32_t capacity;
+  NBT_FlatPool names;
+  NBT_FlatPool payload;
+} NBT_FlatTree;
+
+NBT_FlatTree *flat_parse(uint8_t *buffer, long size);
+NBT_FlatTree *flat_parse_stream(NBT_ReadFn read, void *source, long window);
+void free_flat_tree(NBT_FlatTree *tree);
+
+// Memory held by the tree, pools included
+size_t flat_tree_size(const NBT_FlatTree *tree);
+
+// Direct child of a compound called name, NBT_FLAT_NONE if there is none
+uint32_t flat_child(const NBT_FlatTree *tree, uint32_t node, const char *name,
+                    size_t name_len);
+
+static inline const char *flat_name(const NBT_FlatTree *tree,
+                                    const NBT_FlatNode *node) {
+  return tree->names.data + node->name;
+}
+
+// Strings are NUL terminated in the pool, arrays are aligned for their
+// element type
+static inline const void *flat_data(const NBT_FlatTree *tree,
+                                    const NBT_FlatNode *node) {
+  return tree->payload.data + node->value.data.offset;
+}
+
+static inline uint32_t flat_first_child(const NBT_FlatTree *tree,
+                                        uint32_t node) {
+  return tree->nodes[node].value.count > 0 ? node + 1 : NBT_FLAT_NONE;
+}
+
+#endif // NBT_FLAT_H
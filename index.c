@@ -0,0 +1,204 @@
+#include "index.h"
+#include "names.h"
+#include <stdint.h>
+#include <string.h>
+
+// Child indexes live outside the tags so NBT_Tag does not grow by a pointer.
+// The document maps the element array of every indexed compound to its
+// index. An element array only moves while its compound grows, so a moved
+// array simply misses the map and gets a fresh index.
+
+typedef struct IndexEntry {
+  uint32_t hash;
+  // element index + 1, 0 marks a free entry
+  int32_t slot;
+} IndexEntry;
+
+struct NBT_CompoundIndex {
+  const NBT_Tag *elements;
+  // children covered, tags appended later are added on the next lookup
+  int32_t count;
+  uint32_t mask;
+  IndexEntry entries[];
+};
+
+struct NBT_IndexMap {
+  uint32_t mask;
+  uint32_t count;
+  NBT_CompoundIndex **slots;
+};
+
+static uint32_t hash_pointer(const void *ptr) {
+  uint64_t bits = (uintptr_t)ptr;
+  return (uint32_t)((bits * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static void index_insert(NBT_CompoundIndex *index, const NBT_Tag *compound,
+                         int32_t slot) {
+  const NBT_Tag *child = &compound->value.compound_value.elements[slot];
+  uint32_t hash = hash_name(child->name, child->name_length);
+  uint32_t i = hash & index->mask;
+  while (index->entries[i].slot != 0) {
+    IndexEntry *entry = &index->entries[i];
+    const NBT_Tag *other = &index->elements[entry->slot - 1];
+    // like the linear scan, the first of duplicate names wins
+    if (entry->hash == hash && other->name_length == child->name_length &&
+        memcmp(other->name, child->name, child->name_length) == 0) {
+      return;
+    }
+    i = (i + 1) & index->mask;
+  }
+  index->entries[i].hash = hash;
+  index->entries[i].slot = slot + 1;
+}
+
+static NBT_CompoundIndex *index_build(NBT_Arena *arena,
+                                      const NBT_Tag *compound) {
+  int32_t length = compound->value.compound_value.length;
+  // at most half full, room for the compound to double before a rebuild
+  uint32_t size = 16;
+  while (size < (uint32_t)length * 4) {
+    size *= 2;
+  }
+  NBT_CompoundIndex *index =
+      arena_alloc(arena, sizeof(NBT_CompoundIndex) + size * sizeof(IndexEntry));
+  if (index == NULL) {
+    return NULL;
+  }
+  index->elements = compound->value.compound_value.elements;
+  index->count = length;
+  index->mask = size - 1;
+  memset(index->entries, 0, size * sizeof(IndexEntry));
+  for (int32_t i = 0; i < length; i++) {
+    index_insert(index, compound, i);
+  }
+  return index;
+}
+
+static NBT_CompoundIndex **map_slot(struct NBT_IndexMap *map,
+                                    const NBT_Tag *elements) {
+  uint32_t i = hash_pointer(elements) & map->mask;
+  while (map->slots[i] != NULL && map->slots[i]->elements != elements) {
+    i = (i + 1) & map->mask;
+  }
+  return &map->slots[i];
+}
+
+static int map_grow(NBT_Arena *arena, struct NBT_IndexMap *map) {
+  uint32_t size = map->slots ? (map->mask + 1) * 2 : 64;
+  NBT_CompoundIndex **slots = arena_alloc(arena, size * sizeof(*slots));
+  if (slots == NULL) {
+    return -1;
+  }
+  memset(slots, 0, size * sizeof(*slots));
+  struct NBT_IndexMap grown = {size - 1, map->count, slots};
+  for (uint32_t i = 0; map->slots && i <= map->mask; i++) {
+    if (map->slots[i] != NULL) {
+      *map_slot(&grown, map->slots[i]->elements) = map->slots[i];
+    }
+  }
+  *map = grown;
+  return 0;
+}
+
+NBT_CompoundIndex *compound_index(NBT_Document *doc, NBT_Tag *compound) {
+  int32_t length;
+  tag_elements(doc, compound, &length);
+  if (length < NBT_INDEX_MIN_CHILDREN) {
+    return NULL;
+  }
+
+  struct NBT_IndexMap *map = doc->indexes;
+  if (map == NULL) {
+    map = arena_alloc(&doc->arena, sizeof(struct NBT_IndexMap));
+    if (map == NULL) {
+      return NULL;
+    }
+    map->mask = 0;
+    map->count = 0;
+    map->slots = NULL;
+    doc->indexes = map;
+  }
+  if (map->slots == NULL || (map->count + 1) * 2 > map->mask + 1) {
+    if (map_grow(&doc->arena, map) != 0) {
+      return NULL;
+    }
+  }
+
+  NBT_CompoundIndex **slot =
+      map_slot(map, compound->value.compound_value.elements);
+  NBT_CompoundIndex *index = *slot;
+  if (index != NULL && index->count == length) {
+    return index;
+  }
+  // appended children fit as long as the table stays half empty
+  if (index != NULL && (uint32_t)length * 2 <= index->mask + 1) {
+    for (int32_t i = index->count; i < length; i++) {
+      index_insert(index, compound, i);
+    }
+    index->count = length;
+    return index;
+  }
+
+  NBT_CompoundIndex *built = index_build(&doc->arena, compound);
+  if (built != NULL) {
+    if (index == NULL) {
+      map->count++;
+    }
+    *slot = built;
+  }
+  return built;
+}
+
+NBT_Tag *compound_get(NBT_Document *doc, NBT_Tag *compound, const char *name,
+                      size_t name_len) {
+  if (compound == NULL || compound->tag_type != COMPOUND) {
+    return NULL;
+  }
+  int32_t length;
+  NBT_Tag *elements = tag_elements(doc, compound, &length);
+
+  // with interned names a name nobody uses is rejected right away, any other
+  // is compared by pointer
+  const char *interned = NULL;
+  if (doc->names != NULL) {
+    interned = find_name(doc->names, name, name_len);
+    if (interned == NULL) {
+      return NULL;
+    }
+    if (length < NBT_INDEX_MIN_CHILDREN) {
+      for (int32_t i = 0; i < length; i++) {
+        if (elements[i].name == interned) {
+          return &elements[i];
+        }
+      }
+      return NULL;
+    }
+  }
+
+  NBT_CompoundIndex *index = compound_index(doc, compound);
+  if (index == NULL) {
+    for (int32_t i = 0; i < length; i++) {
+      if (elements[i].name_length == name_len &&
+          memcmp(elements[i].name, name, name_len) == 0) {
+        return &elements[i];
+      }
+    }
+    return NULL;
+  }
+
+  uint32_t hash = hash_name(name, name_len);
+  for (uint32_t i = hash & index->mask; index->entries[i].slot != 0;
+       i = (i + 1) & index->mask) {
+    NBT_Tag *child = &elements[index->entries[i].slot - 1];
+    if (index->entries[i].hash != hash) {
+      continue;
+    }
+    if (interned != NULL ? child->name == interned
+                         : child->name_length == name_len &&
+                               memcmp(child->name, name, name_len) == 0) {
+      return child;
+    }
+  }
+  return NULL;
+}
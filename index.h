@@ -0,0 +1,22 @@
+#ifndef NBT_INDEX_H
+#define NBT_INDEX_H
+
+#include "parser.h"
+#include <stddef.h>
+
+// Compounds with fewer children are scanned, a hash lookup only pays off
+// for larger ones
+#define NBT_INDEX_MIN_CHILDREN 12
+
+typedef struct NBT_CompoundIndex NBT_CompoundIndex;
+
+// Returns the name -> element index of a compound, building it in the
+// document's arena if it is missing or out of date. NULL for compounds too
+// small to be worth indexing. A lazy compound is loaded first.
+NBT_CompoundIndex *compound_index(NBT_Document *doc, NBT_Tag *compound);
+
+// Direct child of compound called name, NULL if there is none
+NBT_Tag *compound_get(NBT_Document *doc, NBT_Tag *compound, const char *name,
+                      size_t name_len);
+
+#endif // NBT_INDEX_H
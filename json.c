@@ -0,0 +1,455 @@
+#include "json.h"
+#include "cursor.h"
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NBT_JSON_X86 1
+#endif
+
+// Bytes json_plain_prefix stops at
+static int needs_escape(uint8_t c) {
+  return c < 0x20 || c == '"' || c == '\\' || c == 0xc0 || c == 0xed;
+}
+
+static size_t plain_scalar(const char *s, size_t len) {
+  size_t i = 0;
+  while (i < len && !needs_escape((uint8_t)s[i])) {
+    i++;
+  }
+  return i;
+}
+
+#ifdef NBT_JSON_X86
+
+// Every byte of a vector is checked against the stop set at once. There is
+// no unsigned less-than, max(c, 1f) == 1f finds the control characters.
+__attribute__((target("sse2"))) static size_t plain_sse2(const char *s,
+                                                         size_t len) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1f);
+  const __m128i nul = _mm_set1_epi8((char)0xc0);
+  const __m128i surrogate = _mm_set1_epi8((char)0xed);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                               _mm_cmpeq_epi8(v, backslash));
+    hit = _mm_or_si128(
+        hit, _mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+    hit = _mm_or_si128(hit, _mm_or_si128(_mm_cmpeq_epi8(v, nul),
+                                         _mm_cmpeq_epi8(v, surrogate)));
+    int mask = _mm_movemask_epi8(hit);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + plain_scalar(s + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t plain_avx2(const char *s,
+                                                         size_t len) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1f);
+  const __m256i nul = _mm256_set1_epi8((char)0xc0);
+  const __m256i surrogate = _mm256_set1_epi8((char)0xed);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+    __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                  _mm256_cmpeq_epi8(v, backslash));
+    hit = _mm256_or_si256(
+        hit, _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+    hit = _mm256_or_si256(hit,
+                          _mm256_or_si256(_mm256_cmpeq_epi8(v, nul),
+                                          _mm256_cmpeq_epi8(v, surrogate)));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + plain_scalar(s + i, len - i);
+}
+
+#endif // NBT_JSON_X86
+
+static size_t (*plain_kernel)(const char *s, size_t len) = plain_scalar;
+
+static void init_kernel(void) {
+#ifdef NBT_JSON_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    plain_kernel = plain_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    plain_kernel = plain_sse2;
+  }
+#endif
+}
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+size_t json_plain_prefix(const char *s, size_t len) {
+  // most strings are a few bytes, too short for the probe to pay off
+  if (len < 16) {
+    return plain_scalar(s, len);
+  }
+  pthread_once(&kernel_once, init_kernel);
+  return plain_kernel(s, len);
+}
+
+static void put_unicode_escape(NBT_Output *out, unsigned code) {
+  static const char hex[] = "0123456789abcdef";
+  char escape[6] = {'\\',
+                    'u',
+                    hex[code >> 12 & 15],
+                    hex[code >> 8 & 15],
+                    hex[code >> 4 & 15],
+                    hex[code & 15]};
+  output_write(out, escape, 6);
+}
+
+// A surrogate as modified UTF-8 encodes it, ED A0..BF xx
+static int is_surrogate(const uint8_t *p, size_t len, uint8_t low,
+                        uint8_t high) {
+  return len >= 3 && p[0] == 0xed && p[1] >= low && p[1] <= high &&
+         (p[2] & 0xc0) == 0x80;
+}
+
+static unsigned surrogate_value(const uint8_t *p) {
+  return 0xd000 | (p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+}
+
+// Writes the sequence at p that json_plain_prefix stopped at and returns
+// how many bytes it took. Modified UTF-8 has NUL as C0 80 and characters
+// outside the BMP as two encoded surrogates, both become plain UTF-8.
+static size_t put_special(NBT_Output *out, const uint8_t *p, size_t len) {
+  switch (p[0]) {
+  case '"':
+    output_write(out, "\\\"", 2);
+    return 1;
+  case '\\':
+    output_write(out, "\\\\", 2);
+    return 1;
+  case '\n':
+    output_write(out, "\\n", 2);
+    return 1;
+  case '\r':
+    output_write(out, "\\r", 2);
+    return 1;
+  case '\t':
+    output_write(out, "\\t", 2);
+    return 1;
+  case 0xc0:
+    if (len >= 2 && p[1] == 0x80) {
+      put_unicode_escape(out, 0);
+      return 2;
+    }
+    break;
+  case 0xed:
+    if (is_surrogate(p, len, 0xa0, 0xaf) &&
+        is_surrogate(p + 3, len - 3, 0xb0, 0xbf)) {
+      unsigned code = 0x10000 + ((surrogate_value(p) - 0xd800) << 10) +
+                      (surrogate_value(p + 3) - 0xdc00);
+      char utf8[4] = {(char)(0xf0 | code >> 18),
+                      (char)(0x80 | (code >> 12 & 0x3f)),
+                      (char)(0x80 | (code >> 6 & 0x3f)),
+                      (char)(0x80 | (code & 0x3f))};
+      output_write(out, utf8, 4);
+      return 6;
+    }
+    // an unpaired surrogate has no UTF-8 form, JSON can still escape it
+    if (is_surrogate(p, len, 0xa0, 0xbf)) {
+      put_unicode_escape(out, surrogate_value(p));
+      return 3;
+    }
+    break;
+  default:
+    if (p[0] < 0x20) {
+      put_unicode_escape(out, p[0]);
+      return 1;
+    }
+    break;
+  }
+  // anything else is left as it is
+  output_char(out, (char)p[0]);
+  return 1;
+}
+
+static void put_string(NBT_Output *out, const char *s, size_t len) {
+  output_char(out, '"');
+  while (len > 0) {
+    size_t plain = json_plain_prefix(s, len);
+    output_write(out, s, plain);
+    if (plain == len) {
+      break;
+    }
+    size_t n = put_special(out, (const uint8_t *)s + plain, len - plain);
+    s += plain + n;
+    len -= plain + n;
+  }
+  output_char(out, '"');
+}
+
+static void put_real(NBT_Output *out, double value, int single) {
+  if (isnan(value) || isinf(value)) {
+    output_write(out, "null", 4);
+  } else if (single) {
+    output_float(out, (float)value);
+  } else {
+    output_double(out, value);
+  }
+}
+
+static void put_number(NBT_Output *out, enum TagType type,
+                       union NBT_Value value) {
+  switch (type) {
+  case BYTE:
+    output_int(out, value.byte_value);
+    break;
+  case SHORT:
+    output_int(out, value.short_value);
+    break;
+  case INT:
+    output_int(out, value.int_value);
+    break;
+  case LONG:
+    output_int(out, value.long_value);
+    break;
+  case FLOAT:
+    put_real(out, value.float_value, 1);
+    break;
+  default:
+    put_real(out, value.double_value, 0);
+    break;
+  }
+}
+
+// Element of an array or list chunk, still big-endian
+static union NBT_Value load_number(enum TagType type, const uint8_t *p) {
+  union NBT_Value value;
+  switch (number_size(type)) {
+  case 1:
+    value.byte_value = (int8_t)p[0];
+    break;
+  case 2:
+    value.short_value = (int16_t)load_be16(p);
+    break;
+  case 4:
+    value.int_value = (int32_t)load_be32(p);
+    break;
+  default:
+    value.long_value = (int64_t)load_be64(p);
+    break;
+  }
+  return value;
+}
+
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Whole groups of three bytes, four digits each
+static void put_base64(NBT_Output *out, const uint8_t *data, size_t groups) {
+  char *dst = output_reserve(out, groups * 4);
+  if (dst == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < groups; i++, data += 3, dst += 4) {
+    uint32_t bits = (uint32_t)data[0] << 16 | data[1] << 8 | data[2];
+    dst[0] = base64_digits[bits >> 18];
+    dst[1] = base64_digits[bits >> 12 & 63];
+    dst[2] = base64_digits[bits >> 6 & 63];
+    dst[3] = base64_digits[bits & 63];
+  }
+  out->len += groups * 4;
+}
+
+// The one or two bytes left at the end of an array, padded with '='
+static void put_base64_tail(NBT_Output *out, const uint8_t *data, int n) {
+  uint32_t bits = (uint32_t)data[0] << 16 | (n > 1 ? data[1] << 8 : 0);
+  char tail[4] = {base64_digits[bits >> 18], base64_digits[bits >> 12 & 63],
+                  n > 1 ? base64_digits[bits >> 6 & 63] : '=', '='};
+  output_write(out, tail, 4);
+}
+
+// Separator and key in front of a value, root values stand alone
+static void json_begin(NBT_JsonWriter *w, const char *name,
+                       uint16_t name_len) {
+  if (w->depth == 0) {
+    return;
+  }
+  if (w->count[w->depth]++ > 0) {
+    output_char(w->out, ',');
+  }
+  if (!w->in_list[w->depth]) {
+    put_string(w->out, name, name_len);
+    output_char(w->out, ':');
+  }
+}
+
+static void json_push(NBT_JsonWriter *w, int in_list) {
+  w->depth++;
+  w->in_list[w->depth] = in_list;
+  w->count[w->depth] = 0;
+}
+
+// Closes the open container, a root ends its line
+static int json_pop(NBT_JsonWriter *w, char close) {
+  output_char(w->out, close);
+  if (--w->depth == 0) {
+    output_char(w->out, '\n');
+  }
+  return w->out->failed;
+}
+
+static int json_begin_compound(void *ctx, const char *name,
+                               uint16_t name_len) {
+  NBT_JsonWriter *w = ctx;
+  json_begin(w, name, name_len);
+  output_char(w->out, '{');
+  json_push(w, 0);
+  return w->out->failed;
+}
+
+static int json_end_compound(void *ctx) { return json_pop(ctx, '}'); }
+
+static int json_scalar(void *ctx, const char *name, uint16_t name_len,
+                       enum TagType type, union NBT_Value value) {
+  NBT_JsonWriter *w = ctx;
+  json_begin(w, name, name_len);
+  put_number(w->out, type, value);
+  if (w->depth == 0) {
+    output_char(w->out, '\n');
+  }
+  return w->out->failed;
+}
+
+static int json_string(void *ctx, const char *name, uint16_t name_len,
+                       const char *value, uint16_t value_len) {
+  NBT_JsonWriter *w = ctx;
+  json_begin(w, name, name_len);
+  put_string(w->out, value, value_len);
+  if (w->depth == 0) {
+    output_char(w->out, '\n');
+  }
+  return w->out->failed;
+}
+
+// Arrays take a level of their own while their chunks arrive, so plain
+// elements are separated like those of a list
+static int json_array_begin(void *ctx, const char *name, uint16_t name_len,
+                            enum TagType type, int32_t length) {
+  NBT_JsonWriter *w = ctx;
+  int base64 = w->arrays == NBT_JSON_ARRAYS_BASE64;
+  json_begin(w, name, name_len);
+  output_char(w->out, base64 ? '"' : '[');
+  json_push(w, 1);
+  w->chunk_type = type == BYTE_ARRAY ? BYTE : type == INT_ARRAY ? INT : LONG;
+  w->array_remaining = length;
+  w->carry_len = 0;
+  if (length == 0) {
+    return json_pop(w, base64 ? '"' : ']');
+  }
+  return w->out->failed;
+}
+
+static void json_put_chunk(NBT_JsonWriter *w, const uint8_t *data,
+                           int32_t count) {
+  int width = number_size(w->chunk_type);
+  for (int32_t i = 0; i < count; i++) {
+    if (w->count[w->depth]++ > 0) {
+      output_char(w->out, ',');
+    }
+    put_number(w->out, w->chunk_type,
+               load_number(w->chunk_type, data + (size_t)i * width));
+  }
+}
+
+// Chunks need not end on a group of three, the bytes left over wait in
+// carry for the next chunk or the end of the array
+static void json_put_base64_chunk(NBT_JsonWriter *w, const uint8_t *data,
+                                  size_t size) {
+  if (w->carry_len > 0) {
+    size_t taken = 3 - w->carry_len;
+    if (size < taken) {
+      memcpy(w->carry + w->carry_len, data, size);
+      w->carry_len += size;
+      return;
+    }
+    uint8_t group[3];
+    memcpy(group, w->carry, w->carry_len);
+    memcpy(group + w->carry_len, data, taken);
+    put_base64(w->out, group, 1);
+    data += taken;
+    size -= taken;
+  }
+  size_t groups = size / 3;
+  put_base64(w->out, data, groups);
+  w->carry_len = size - groups * 3;
+  memcpy(w->carry, data + groups * 3, w->carry_len);
+}
+
+static int json_array_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  NBT_JsonWriter *w = ctx;
+  int base64 = w->arrays == NBT_JSON_ARRAYS_BASE64;
+  if (base64) {
+    json_put_base64_chunk(w, data,
+                          (size_t)count * number_size(w->chunk_type));
+  } else {
+    json_put_chunk(w, data, count);
+  }
+  w->array_remaining -= count;
+  if (w->array_remaining > 0) {
+    return w->out->failed;
+  }
+  if (base64 && w->carry_len > 0) {
+    put_base64_tail(w->out, w->carry, w->carry_len);
+  }
+  return json_pop(w, base64 ? '"' : ']');
+}
+
+static int json_list_begin(void *ctx, const char *name, uint16_t name_len,
+                           enum TagType element_type, int32_t length) {
+  NBT_JsonWriter *w = ctx;
+  (void)length;
+  json_begin(w, name, name_len);
+  output_char(w->out, '[');
+  json_push(w, 1);
+  w->chunk_type = element_type;
+  return w->out->failed;
+}
+
+static int json_list_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  NBT_JsonWriter *w = ctx;
+  json_put_chunk(w, data, count);
+  return w->out->failed;
+}
+
+static int json_list_end(void *ctx) { return json_pop(ctx, ']'); }
+
+const NBT_Handler json_handler = {
+    .begin_compound = json_begin_compound,
+    .end_compound = json_end_compound,
+    .scalar = json_scalar,
+    .string = json_string,
+    .array_begin = json_array_begin,
+    .array_chunk = json_array_chunk,
+    .list_begin = json_list_begin,
+    .list_chunk = json_list_chunk,
+    .list_end = json_list_end,
+};
+
+void init_json_writer(NBT_JsonWriter *w, NBT_Output *out,
+                      enum NBT_JsonArrays arrays) {
+  w->out = out;
+  w->arrays = arrays;
+  w->depth = 0;
+  w->in_list[0] = 0;
+  w->count[0] = 0;
+  w->chunk_type = BYTE;
+  w->array_remaining = 0;
+  w->carry_len = 0;
+}
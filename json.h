@@ -0,0 +1,49 @@
+#ifndef NBT_JSON_H
+#define NBT_JSON_H
+
+#include "events.h"
+#include "output.h"
+#include <stddef.h>
+
+// JSON export driven by the walker, so it streams like the walk does. Every
+// root tag is one line holding its value: compounds become objects, lists
+// and arrays become arrays, numbers stay numbers, NaN and infinities are
+// null. Strings are converted from Java's modified UTF-8 to UTF-8.
+
+// How BYTE_ARRAY, INT_ARRAY and LONG_ARRAY payloads are written
+enum NBT_JsonArrays {
+  // [1,2,3]
+  NBT_JSON_ARRAYS_PLAIN,
+  // "AAAAAQAAAAIAAAAD", the big-endian payload as stored in the file
+  NBT_JSON_ARRAYS_BASE64,
+};
+
+typedef struct NBT_JsonWriter {
+  NBT_Output *out;
+  enum NBT_JsonArrays arrays;
+  int depth;
+  // the open container at each depth is a list, its elements have no key
+  uint8_t in_list[NBT_MAX_DEPTH + 2];
+  // values written so far in the open container at each depth
+  int32_t count[NBT_MAX_DEPTH + 2];
+  // element type of the array or packed list whose chunks are arriving,
+  // and how many elements of the array are still to come
+  enum TagType chunk_type;
+  int32_t array_remaining;
+  // base64 bytes of the array that did not fill a group of three yet
+  uint8_t carry[2];
+  int carry_len;
+} NBT_JsonWriter;
+
+// Handler that writes the events it is fed as JSON
+extern const NBT_Handler json_handler;
+void init_json_writer(NBT_JsonWriter *w, NBT_Output *out,
+                      enum NBT_JsonArrays arrays);
+
+// Length of the longest prefix of s that goes into a JSON string as it is,
+// scanned 16 or 32 bytes at a time where the CPU allows. Stops at quotes,
+// backslashes, control characters and the lead bytes of modified UTF-8
+// sequences (C0 and ED).
+size_t json_plain_prefix(const char *s, size_t len);
+
+#endif // NBT_JSON_H
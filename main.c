@@ -1,107 +1,465 @@
+#include "batch.h"
 #include "file.h"
+#include "json.h"
 #include "operations.h"
 #include "parser.h"
+#include "printer.h"
+#include "query.h"
+#include "region.h"
+#include "snbt.h"
+#include "threadpool.h"
+#include "writer.h"
 #include "zlib.h"
+#include <errno.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/_types/_null.h>
+#include <unistd.h>
 
 #define UNUSED(x) (void)(x)
 
-NBT_Tag *parse(uint8_t buffer[], long size) {
-  long pos = 0;
-  int depth = 0;
-  NBT_Tag *root_compound = NULL;
-  NBT_Tag *current_compound = NULL;
+// How tags are printed
+enum PrintFormat { PRINT_TREE, PRINT_SNBT, PRINT_JSON };
 
-  while (pos < size) {
-    uint8_t current = buffer[pos];
+// What print_chunk and print_file print of every buffer
+typedef struct PrintOptions {
+  const NBT_Query *query;
+  enum PrintFormat format;
+  // for PRINT_JSON
+  enum NBT_JsonArrays arrays;
+} PrintOptions;
 
-    switch (current) {
-    case END:
-      parse_end_tag(current_compound, &depth, &pos);
-      break;
-
-    case COMPOUND:
-      parse_compound_tag(buffer, &pos, &depth, &current_compound,
-                         &root_compound);
-      break;
+typedef struct TextWriter {
+  union {
+    NBT_Printer printer;
+    NBT_SnbtWriter snbt;
+    NBT_JsonWriter json;
+  };
+  NBT_QueryMatcher matcher;
+} TextWriter;
 
-    case INT:
-      parse_int_tag(buffer, &pos, depth, current_compound);
-      break;
+// Sets up the handler that writes the format of options to out, behind a
+// matcher when there is a query, so each match is printed as if it were a
+// root tag. Returns the handler and its context in *ctx.
+static const NBT_Handler *text_handler(TextWriter *t, NBT_Output *out,
+                                       const PrintOptions *options,
+                                       void **ctx) {
+  const NBT_Handler *handler;
+  if (options->format == PRINT_SNBT) {
+    init_snbt_writer(&t->snbt, out);
+    handler = &snbt_handler;
+    *ctx = &t->snbt;
+  } else if (options->format == PRINT_JSON) {
+    init_json_writer(&t->json, out, options->arrays);
+    handler = &json_handler;
+    *ctx = &t->json;
+  } else {
+    init_printer(&t->printer, out);
+    handler = &print_handler;
+    *ctx = &t->printer;
+  }
+  if (options->query != NULL) {
+    init_query_matcher(&t->matcher, options->query, handler, *ctx);
+    handler = &query_handler;
+    *ctx = &t->matcher;
+  }
+  return handler;
+}
 
-    case BYTE:
-      parse_byte_tag(buffer, &pos, depth, current_compound);
-      break;
+static int print_contents(NBT_Output *out, const PrintOptions *options,
+                          uint8_t *buffer, long size) {
+  if (options->format == PRINT_TREE && options->query == NULL) {
+    return print_buffer_to(out, buffer, size);
+  }
+  TextWriter t;
+  void *ctx;
+  const NBT_Handler *handler = text_handler(&t, out, options, &ctx);
+  return nbt_walk(buffer, size, handler, ctx);
+}
 
-    case FLOAT:
-      parse_float_tag(buffer, &pos, depth, current_compound);
-      break;
+static void print_chunk(void *ctx, RegionChunk *chunk) {
+  output_str(chunk->out, "Chunk ");
+  output_int(chunk->out, chunk->x);
+  output_char(chunk->out, ',');
+  output_int(chunk->out, chunk->z);
+  output_char(chunk->out, '\n');
+  print_contents(chunk->out, ctx, chunk->data, chunk->size);
+}
 
-    case DOUBLE:
-      parse_double_tag(buffer, &pos, depth, current_compound);
-      break;
+static void print_file(void *ctx, BatchFile *file) {
+  output_str(file->out, "File ");
+  output_str(file->out, file->name);
+  output_char(file->out, '\n');
+  print_contents(file->out, ctx, file->data, file->size);
+}
 
-    case SHORT:
-      parse_short_tag(buffer, &pos, depth, current_compound);
-      break;
+// Prints a list of files in one process, several of them at a time. Files
+// are printed straight from their bytes, no tree is built.
+static int print_files(const NBT_FileList *files,
+                       const PrintOptions *options, int flags, int threads) {
+  NBT_Output out;
+  if (output_init_fd(&out, STDOUT_FILENO, 0) != 0) {
+    return 1;
+  }
+  NBT_Pool *pool = create_pool(threads);
+  if (pool == NULL) {
+    output_release(&out);
+    return 1;
+  }
+  int failed =
+      batch_scan(files, pool, flags, print_file, (void *)options, &out);
+  destroy_pool(pool);
+  return (output_release(&out) != 0) | (failed != 0);
+}
 
-    case LONG:
-      parse_long_tag(buffer, &pos, depth, current_compound);
-      break;
+// Prints every chunk of a region, decoding them on all threads. Chunks are
+// printed straight from their bytes, no tree is built.
+static int print_region(const char *filename, const PrintOptions *options,
+                        int flags, int threads) {
+  NBT_Region *mca = open_region(filename);
+  if (mca == NULL) {
+    return 1;
+  }
+  NBT_Output out;
+  NBT_Pool *pool = create_pool(threads);
+  if (pool == NULL || output_init_fd(&out, STDOUT_FILENO, 0) != 0) {
+    destroy_pool(pool);
+    close_region(mca);
+    return 1;
+  }
+  int failed =
+      region_scan(mca, pool, flags, print_chunk, (void *)options, &out);
+  destroy_pool(pool);
+  close_region(mca);
+  return (output_release(&out) != 0) | (failed != 0);
+}
 
-    case STRING:
-      parse_string_tag(buffer, &pos, depth, current_compound);
-      break;
+// Writes every chunk of a region to a new region file, compressing them on
+// all threads
+static int rewrite_region(const char *filename, const char *write_to,
+                          enum NBT_Compression compression, int threads) {
+  NBT_Region *mca = open_region(filename);
+  if (mca == NULL) {
+    return 1;
+  }
+  NBT_Pool *pool = create_pool(threads);
+  if (pool == NULL) {
+    close_region(mca);
+    return 1;
+  }
+  enum RegionCompression scheme =
+      compression == NBT_COMPRESS_GZIP   ? REGION_GZIP
+      : compression == NBT_COMPRESS_ZLIB ? REGION_ZLIB
+                                         : REGION_UNCOMPRESSED;
+  int failed = region_write(mca, pool, write_to, scheme);
+  destroy_pool(pool);
+  close_region(mca);
+  return failed != 0;
+}
 
-    case LIST:
-      parse_list_tag(buffer, &pos, depth, current_compound);
-      break;
+// Sets the scalar at PATH from the text after the last '=' of arg, read as
+// the type of that tag
+static int apply_edit(NBT_Document *doc, const char *arg) {
+  const char *eq = strrchr(arg, '=');
+  char *path = strndup(arg, eq - arg);
+  if (path == NULL) {
+    return -1;
+  }
+  NBT_Tag *tag = find_path(doc, path);
+  if (tag == NULL) {
+    printf("No tag at %s\n", path);
+    free(path);
+    return -1;
+  }
+  free(path);
 
-    case BYTE_ARRAY:
-      parse_byte_array_tag(buffer, &pos, depth, current_compound);
+  const char *text = eq + 1;
+  char *end;
+  union NBT_Value value;
+  errno = 0;
+  if (tag->tag_type == FLOAT || tag->tag_type == DOUBLE) {
+    double d = strtod(text, &end);
+    if (tag->tag_type == FLOAT) {
+      value.float_value = d;
+    } else {
+      value.double_value = d;
+    }
+  } else {
+    long long v = strtoll(text, &end, 10);
+    int ok = 1;
+    switch (tag->tag_type) {
+    case BYTE:
+      ok = v >= INT8_MIN && v <= INT8_MAX;
+      value.byte_value = v;
       break;
-
-    case INT_ARRAY:
-      parse_int_array_tag(buffer, &pos, depth, current_compound);
+    case SHORT:
+      ok = v >= INT16_MIN && v <= INT16_MAX;
+      value.short_value = v;
       break;
-
-    case LONG_ARRAY:
-      parse_long_array_tag(buffer, &pos, depth, current_compound);
+    case INT:
+      ok = v >= INT32_MIN && v <= INT32_MAX;
+      value.int_value = v;
       break;
-
     default:
-      printf("Unknown tag type %d at position %ld (0x%lx)\n", current, pos,
-             pos);
-      printf("Context: depth=%d, current tag name=%s\n", depth,
-             current_compound ? current_compound->name : "none");
-      pos++;
+      value.long_value = v;
+      break;
     }
+    if (!ok) {
+      errno = ERANGE;
+    }
+  }
+  if (end == text || *end != '\0' || errno != 0) {
+    printf("Not a valid value for %.*s: %s\n", (int)(eq - arg), arg, text);
+    return -1;
   }
-  return root_compound;
+  return edit_tag(doc, tag, value);
 }
 
 int main(int argc, char *argv[]) {
-  UNUSED(argc);
-  if (argv[1] == NULL) {
-    printf("Target file name not provided");
+  NBT_FileList files;
+  file_list_init(&files);
+  // more than one name, a glob pattern or a list on stdin
+  int batch = 0;
+  int flags = 0;
+  int stream = 0;
+  long window = 1024 * 1024;
+  int chunk_x = 0, chunk_z = 0, region = 0;
+  int whole_region = 0, threads = 0;
+  enum PrintFormat format = PRINT_TREE;
+  enum NBT_JsonArrays arrays = NBT_JSON_ARRAYS_PLAIN;
+  const char *write_to = NULL;
+  // number of --set arguments, they are applied in order once parsed
+  int edits = 0;
+  enum NBT_Compression compression = NBT_COMPRESS_GZIP;
+  NBT_Query *query = NULL;
+  // large outputs are compressed in blocks on all threads
+  NBT_Pool *pool = NULL;
+  // every exit below goes through done, which frees the above
+  int result = 1;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--zero-copy") == 0) {
+      flags |= NBT_PARSE_ZERO_COPY;
+    } else if (strcmp(argv[i], "--snbt") == 0) {
+      format = PRINT_SNBT;
+    } else if (strcmp(argv[i], "--json") == 0) {
+      format = PRINT_JSON;
+    } else if (strncmp(argv[i], "--json-arrays=", 14) == 0) {
+      const char *name = argv[i] + 14;
+      format = PRINT_JSON;
+      if (strcmp(name, "plain") == 0) {
+        arrays = NBT_JSON_ARRAYS_PLAIN;
+      } else if (strcmp(name, "base64") == 0) {
+        arrays = NBT_JSON_ARRAYS_BASE64;
+      } else {
+        printf("Expected --json-arrays=plain or base64\n");
+        goto done;
+      }
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      flags |= NBT_PARSE_LAZY;
+    } else if (strcmp(argv[i], "--stream") == 0) {
+      stream = 1;
+    } else if (strncmp(argv[i], "--window=", 9) == 0) {
+      stream = 1;
+      window = atol(argv[i] + 9);
+    } else if (strncmp(argv[i], "--chunk=", 8) == 0) {
+      if (sscanf(argv[i] + 8, "%d,%d", &chunk_x, &chunk_z) != 2) {
+        printf("Expected --chunk=X,Z\n");
+        goto done;
+      }
+      region = 1;
+    } else if (strcmp(argv[i], "--region") == 0) {
+      whole_region = 1;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      threads = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--set=", 6) == 0) {
+      if (strchr(argv[i] + 6, '=') == NULL) {
+        printf("Expected --set=PATH=VALUE\n");
+        goto done;
+      }
+      edits++;
+    } else if (strncmp(argv[i], "--write=", 8) == 0) {
+      write_to = argv[i] + 8;
+    } else if (strncmp(argv[i], "--compression=", 14) == 0) {
+      const char *name = argv[i] + 14;
+      if (strcmp(name, "gzip") == 0) {
+        compression = NBT_COMPRESS_GZIP;
+      } else if (strcmp(name, "zlib") == 0) {
+        compression = NBT_COMPRESS_ZLIB;
+      } else if (strcmp(name, "none") == 0) {
+        compression = NBT_COMPRESS_NONE;
+      } else {
+        printf("Expected --compression=gzip, zlib or none\n");
+        goto done;
+      }
+    } else if (strncmp(argv[i], "--query=", 8) == 0) {
+      free_query(query);
+      query = compile_query(argv[i] + 8);
+      if (query == NULL) {
+        goto done;
+      }
+    } else {
+      batch |= files.count > 0 || strcmp(argv[i], "-") == 0 ||
+               strpbrk(argv[i], "*?[") != NULL;
+      if (file_list_add(&files, argv[i]) != 0) {
+        goto done;
+      }
+    }
   }
 
-  uint8_t *decompressed_data;
+  if (files.count == 0) {
+    printf("Target file name not provided\n");
+    goto done;
+  }
+  if (write_to != NULL && (batch || query != NULL)) {
+    printf("--write takes a single file, chunk or region, without "
+           "--query\n");
+    goto done;
+  }
+  if (edits > 0 && (write_to == NULL || stream || whole_region)) {
+    printf("--set needs --write and a parsed tree, not --stream or "
+           "--region\n");
+    goto done;
+  }
+  PrintOptions options = {query, format, arrays};
+  if (edits > 0) {
+    // edits are patched into the decompressed buffer, which is then only
+    // compressed again
+    flags |= NBT_PARSE_LAZY;
+  }
+  if (batch) {
+    if (stream || region || whole_region) {
+      printf("--stream, --chunk and --region take a single file\n");
+      goto done;
+    }
+    result = print_files(&files, &options, flags, threads);
+    goto done;
+  }
+  const char *filename = files.names[0];
 
-  long file_size = decompress_gzip(argv[1], &decompressed_data);
+  if (whole_region && write_to != NULL) {
+    result = rewrite_region(filename, write_to, compression, threads);
+    goto done;
+  }
+  if (whole_region) {
+    result = print_region(filename, &options, flags, threads);
+    goto done;
+  }
+
+  if (write_to != NULL && compression != NBT_COMPRESS_NONE) {
+    pool = create_pool(threads);
+  }
+
+  // streaming only prints, memory stays bounded by the window no matter how
+  // large the file is
+  if (stream) {
+    gzFile gz = open_gzip_stream(filename);
+    if (gz == NULL) {
+      goto done;
+    }
+    int walked;
+    if (write_to != NULL) {
+      // re-encoded from the events, no tree is built
+      NBT_Output out;
+      NBT_Writer writer;
+      size_t len;
+      if (output_init_memory(&out, 0) != 0) {
+        gzclose(gz);
+        goto done;
+      }
+      init_writer(&writer, &out);
+      walked = nbt_walk_stream(read_gzip, gz, window, &write_handler, &writer);
+      char *data = output_take(&out, &len);
+      if (walked != NBT_WALK_DONE || out.failed ||
+          write_compressed(write_to, (const uint8_t *)data, len, compression,
+                           pool) != 0) {
+        walked = NBT_WALK_ERROR;
+      }
+      free(data);
+    } else if (query != NULL || format != PRINT_TREE) {
+      NBT_Output out;
+      if (output_init_fd(&out, STDOUT_FILENO, 0) != 0) {
+        gzclose(gz);
+        goto done;
+      }
+      TextWriter t;
+      void *ctx;
+      const NBT_Handler *handler = text_handler(&t, &out, &options, &ctx);
+      walked = nbt_walk_stream(read_gzip, gz, window, handler, ctx);
+      output_release(&out);
+    } else {
+      walked = print_stream(read_gzip, gz, window);
+    }
+    gzclose(gz);
+    result = walked == NBT_WALK_ERROR;
+    goto done;
+  }
+
+  // raw NBT of the file or chunk, mapped from a large uncompressed file
+  NBT_Input input;
+
+  if (region) {
+    NBT_Region *mca = open_region(filename);
+    if (mca == NULL) {
+      goto done;
+    }
+    input.size = region_read_chunk(mca, chunk_x, chunk_z, &input.data);
+    input.mapped = 0;
+    close_region(mca);
+    if (input.size == 0) {
+      printf("Chunk %d,%d is not present in %s\n", chunk_x, chunk_z,
+             filename);
+    }
+    if (input.size <= 0) {
+      goto done;
+    }
+  } else if (open_input(filename, NULL, &input) != 0) {
+    goto done;
+  }
+
+  // printing walks the events, a tree is only built to be written back
+  if (write_to == NULL) {
+    NBT_Output out;
+    if (output_init_fd(&out, STDOUT_FILENO, 0) == 0) {
+      result = print_contents(&out, &options, input.data, input.size) ==
+               NBT_WALK_ERROR;
+      result |= output_release(&out) != 0;
+    }
+    close_input(&input);
+    goto done;
+  }
+
+  if (input.mapped) {
+    flags |= NBT_PARSE_MAPPED;
+  }
+  NBT_Document *doc = parse(input.data, input.size, flags);
+  result = doc == NULL;
+  if (doc != NULL && doc->root == NULL) {
+    printf("No tag to write in %s\n", filename);
+    result = 1;
+  }
+  for (int i = 1; doc != NULL && result == 0 && i < argc; i++) {
+    if (strncmp(argv[i], "--set=", 6) == 0) {
+      result = apply_edit(doc, argv[i] + 6) != 0;
+    }
+  }
+  if (doc != NULL && result == 0 && edits > 0) {
+    result = write_compressed(write_to, doc->buffer, doc->size, compression,
+                              pool) != 0;
+  } else if (doc != NULL && result == 0) {
+    result = save_document(write_to, doc, compression, pool) != 0;
+  }
+  // a zero-copy or lazy document owns the buffer, unless parsing failed
+  if (doc == NULL || !(flags & NBT_PARSE_OWNS_BUFFER)) {
+    close_input(&input);
+  }
+  free_document(doc);
 
-  parse(decompressed_data, file_size);
-  // if (argv[2] != NULL) {
-  //   NBT_Tag *search_result = find_tag(root_compound, argv[2]);
-  //   if (search_result == NULL) {
-  //     PRINT_TAG("Could not find tag");
-  //     exit(1);
-  //   }
-  //   PRINT_TAG("Found tag name: %s\n", search_result->name);
-  // }
+done:
+  destroy_pool(pool);
+  free_query(query);
+  file_list_free(&files);
+  return result;
 }
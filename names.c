@@ -0,0 +1,90 @@
+#include "names.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t hash_name(const char *name, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+void name_table_init(NBT_NameTable *table) {
+  // a few thousand distinct names cover a whole world
+  arena_init(&table->arena, 16 * 1024);
+  table->entries = NULL;
+  table->mask = 0;
+  table->count = 0;
+}
+
+void name_table_free(NBT_NameTable *table) {
+  arena_release(&table->arena);
+  free(table->entries);
+  table->entries = NULL;
+  table->mask = 0;
+  table->count = 0;
+}
+
+static NameEntry *name_slot(NameEntry *entries, uint32_t mask, uint32_t hash,
+                            const char *name, size_t len) {
+  uint32_t i = hash & mask;
+  while (entries[i].name != NULL &&
+         (entries[i].hash != hash || entries[i].length != len ||
+          memcmp(entries[i].name, name, len) != 0)) {
+    i = (i + 1) & mask;
+  }
+  return &entries[i];
+}
+
+static int name_table_grow(NBT_NameTable *table) {
+  uint32_t size = table->entries ? (table->mask + 1) * 2 : 256;
+  NameEntry *entries = calloc(size, sizeof(NameEntry));
+  if (entries == NULL) {
+    printf("Could not allocate memory for name table\n");
+    return -1;
+  }
+  for (uint32_t i = 0; table->entries && i <= table->mask; i++) {
+    NameEntry *entry = &table->entries[i];
+    if (entry->name != NULL) {
+      *name_slot(entries, size - 1, entry->hash, entry->name, entry->length) =
+          *entry;
+    }
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->mask = size - 1;
+  return 0;
+}
+
+const char *intern_name(NBT_NameTable *table, const char *name, size_t len) {
+  if (table->entries == NULL || (table->count + 1) * 2 > table->mask + 1) {
+    if (name_table_grow(table) != 0) {
+      return NULL;
+    }
+  }
+  uint32_t hash = hash_name(name, len);
+  NameEntry *entry = name_slot(table->entries, table->mask, hash, name, len);
+  if (entry->name == NULL) {
+    char *copy = arena_strndup(&table->arena, name, len);
+    if (copy == NULL) {
+      return NULL;
+    }
+    entry->hash = hash;
+    entry->length = len;
+    entry->name = copy;
+    table->count++;
+  }
+  return entry->name;
+}
+
+const char *find_name(const NBT_NameTable *table, const char *name,
+                      size_t len) {
+  if (table->entries == NULL || len > UINT16_MAX) {
+    return NULL;
+  }
+  return name_slot(table->entries, table->mask, hash_name(name, len), name,
+                   len)
+      ->name;
+}
@@ -0,0 +1,41 @@
+#ifndef NBT_NAMES_H
+#define NBT_NAMES_H
+
+#include "arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Set of distinct tag names. A document parsed with a name table stores each
+// name once in the table instead of once per tag, and two names of such a
+// document are equal exactly when their pointers are. A table can outlive
+// and be shared by any number of documents, but not between threads.
+
+typedef struct NameEntry {
+  uint32_t hash;
+  uint16_t length;
+  // NUL terminated copy in the table's arena, NULL marks a free entry
+  const char *name;
+} NameEntry;
+
+typedef struct NBT_NameTable {
+  NBT_Arena arena;
+  NameEntry *entries;
+  uint32_t mask;
+  uint32_t count;
+} NBT_NameTable;
+
+void name_table_init(NBT_NameTable *table);
+void name_table_free(NBT_NameTable *table);
+
+// The table's copy of name, added if it is new. NULL if it could not be
+// allocated.
+const char *intern_name(NBT_NameTable *table, const char *name, size_t len);
+// The table's copy of name, NULL if no document of the table has a tag
+// called that
+const char *find_name(const NBT_NameTable *table, const char *name,
+                      size_t len);
+
+// FNV-1a, names are short so anything fancier does not pay off
+uint32_t hash_name(const char *name, size_t len);
+
+#endif // NBT_NAMES_H
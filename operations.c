@@ -1,21 +1,29 @@
 #include "parser.h"
+#include "index.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-NBT_Tag *find_tag(NBT_Tag *compound, const char *name) {
+// names are compared by length since zero-copy documents do not NUL
+// terminate them, interned names (doc->names) by pointer
+static NBT_Tag *find_tag_len(NBT_Document *doc, NBT_Tag *compound,
+                             const char *name, size_t name_len) {
   if (compound->tag_type != COMPOUND) {
     printf("Tag is not a compound tag");
     exit(1);
   }
-  for (int i = 0; i < compound->value.compound_value.length; i++) {
-    if (strcmp(compound->value.compound_value.elements[i].name, name) == 0) {
-      return &compound->value.compound_value.elements[i];
+  int32_t length;
+  NBT_Tag *elements = tag_elements(doc, compound, &length);
+  for (int i = 0; i < length; i++) {
+    NBT_Tag *element = &elements[i];
+    if (doc->names != NULL ? element->name == name
+                           : element->name_length == name_len &&
+                                 memcmp(element->name, name, name_len) == 0) {
+      return element;
     }
 
-    if (compound->value.compound_value.elements[i].tag_type == COMPOUND) {
-      NBT_Tag *tag =
-          find_tag(&compound->value.compound_value.elements[i], name);
+    if (element->tag_type == COMPOUND) {
+      NBT_Tag *tag = find_tag_len(doc, element, name, name_len);
       if (tag != NULL) {
         return tag;
       }
@@ -24,5 +32,86 @@ NBT_Tag *find_tag(NBT_Tag *compound, const char *name) {
   return NULL;
 }
 
-// TODO: someday
-void edit_tag(NBT_Tag *tag, union NBT_Value value) { tag->value = value; }
+// Searches the whole subtree depth first, find_path is much faster when the
+// exact location is known
+NBT_Tag *find_tag(NBT_Document *doc, NBT_Tag *compound, const char *name) {
+  size_t name_len = strlen(name);
+  if (doc->names != NULL) {
+    name = find_name(doc->names, name, name_len);
+    if (name == NULL) {
+      return NULL;
+    }
+  }
+  return find_tag_len(doc, compound, name, name_len);
+}
+
+// Looks up a tag by the names of the compounds leading to it, separated by
+// dots and starting below the root compound ("Data.Player.Health"). Each
+// step is one index lookup, so the cost depends on the depth only.
+NBT_Tag *find_path(NBT_Document *doc, const char *path) {
+  NBT_Tag *tag = doc->root;
+  while (tag != NULL) {
+    const char *dot = strchr(path, '.');
+    size_t len = dot ? (size_t)(dot - path) : strlen(path);
+    tag = compound_get(doc, tag, path, len);
+    if (dot == NULL) {
+      return tag;
+    }
+    path = dot + 1;
+  }
+  return NULL;
+}
+
+// Sets the value of a scalar tag. In a lazy document the new value is also
+// stored big-endian over the old one in the document's buffer, which then
+// stays a valid encoding of the edited tree: writing it out only needs the
+// compression step, nothing is decoded or encoded again.
+int edit_tag(NBT_Document *doc, NBT_Tag *tag, union NBT_Value value) {
+  uint64_t bits;
+  uint32_t bits32;
+  int width;
+  switch (tag->tag_type) {
+  case BYTE:
+    bits = (uint8_t)value.byte_value;
+    width = 1;
+    break;
+  case SHORT:
+    bits = (uint16_t)value.short_value;
+    width = 2;
+    break;
+  case INT:
+    bits = (uint32_t)value.int_value;
+    width = 4;
+    break;
+  case FLOAT:
+    memcpy(&bits32, &value.float_value, 4);
+    bits = bits32;
+    width = 4;
+    break;
+  case LONG:
+    bits = (uint64_t)value.long_value;
+    width = 8;
+    break;
+  case DOUBLE:
+    memcpy(&bits, &value.double_value, 8);
+    width = 8;
+    break;
+  default:
+    printf("Only byte, short, int, long, float and double tags can be "
+           "edited\n");
+    return -1;
+  }
+
+  long offset = tag->value.scalar.offset;
+  tag->value = value;
+  if (!(doc->flags & NBT_PARSE_LAZY)) {
+    return 0;
+  }
+  tag->value.scalar.offset = offset;
+  uint8_t *dst = doc->buffer + offset;
+  for (int i = width - 1; i >= 0; i--) {
+    dst[i] = bits & 0xff;
+    bits >>= 8;
+  }
+  return 0;
+}
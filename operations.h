@@ -1,4 +1,6 @@
 
 #include "parser.h"
 
-NBT_Tag *find_tag(NBT_Tag *compound, const char *name);
+NBT_Tag *find_tag(NBT_Document *doc, NBT_Tag *compound, const char *name);
+NBT_Tag *find_path(NBT_Document *doc, const char *path);
+int edit_tag(NBT_Document *doc, NBT_Tag *tag, union NBT_Value value);
@@ -0,0 +1,40 @@
+#include "ordered.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+int ordered_init(NBT_OrderedOutput *output, NBT_Output *out, long count) {
+  output->slots = calloc(count > 0 ? count : 1, sizeof(NBT_OrderedSlot));
+  if (output->slots == NULL) {
+    printf("Could not allocate memory for ordered output\n");
+    return -1;
+  }
+  output->out = out;
+  output->count = count;
+  output->next = 0;
+  pthread_mutex_init(&output->lock, NULL);
+  return 0;
+}
+
+void ordered_emit(NBT_OrderedOutput *output, long index, char *text,
+                  size_t len) {
+  pthread_mutex_lock(&output->lock);
+  output->slots[index].text = text;
+  output->slots[index].len = len;
+  output->slots[index].ready = 1;
+  while (output->next < output->count && output->slots[output->next].ready) {
+    NBT_OrderedSlot *slot = &output->slots[output->next++];
+    output_write(output->out, slot->text, slot->len);
+    free(slot->text);
+    slot->text = NULL;
+  }
+  pthread_mutex_unlock(&output->lock);
+}
+
+void ordered_release(NBT_OrderedOutput *output) {
+  // only left over if a task never reported, drop its successors
+  for (long i = output->next; i < output->count; i++) {
+    free(output->slots[i].text);
+  }
+  pthread_mutex_destroy(&output->lock);
+  free(output->slots);
+}
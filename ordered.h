@@ -0,0 +1,30 @@
+#ifndef NBT_ORDERED_H
+#define NBT_ORDERED_H
+
+#include "output.h"
+#include <pthread.h>
+#include <stddef.h>
+
+typedef struct NBT_OrderedSlot {
+  char *text;
+  size_t len;
+  int ready;
+} NBT_OrderedSlot;
+
+// Collects the output of tasks finishing in any order and writes it to out
+// in task order, as soon as every earlier task is done
+typedef struct NBT_OrderedOutput {
+  NBT_Output *out;
+  NBT_OrderedSlot *slots;
+  long count;
+  long next;
+  pthread_mutex_t lock;
+} NBT_OrderedOutput;
+
+int ordered_init(NBT_OrderedOutput *output, NBT_Output *out, long count);
+// Takes ownership of text (malloc'd, may be NULL when len is 0)
+void ordered_emit(NBT_OrderedOutput *output, long index, char *text,
+                  size_t len);
+void ordered_release(NBT_OrderedOutput *output);
+
+#endif // NBT_ORDERED_H
@@ -0,0 +1,241 @@
+#include "output.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int output_init(NBT_Output *out, int fd, size_t capacity) {
+  out->buf = malloc(capacity);
+  if (out->buf == NULL) {
+    printf("Could not allocate output buffer of %zu bytes\n", capacity);
+    return -1;
+  }
+  out->len = 0;
+  out->capacity = capacity;
+  out->fd = fd;
+  out->failed = 0;
+  return 0;
+}
+
+int output_init_fd(NBT_Output *out, int fd, size_t capacity) {
+  return output_init(out, fd, capacity ? capacity : NBT_OUTPUT_SIZE);
+}
+
+int output_init_memory(NBT_Output *out, size_t capacity) {
+  return output_init(out, -1, capacity ? capacity : 4096);
+}
+
+int output_flush(NBT_Output *out) {
+  if (out->fd < 0) {
+    return 0;
+  }
+  size_t done = 0;
+  while (done < out->len && !out->failed) {
+    ssize_t n = write(out->fd, out->buf + done, out->len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      out->failed = 1;
+      break;
+    }
+    done += n;
+  }
+  out->len = 0;
+  return out->failed ? -1 : 0;
+}
+
+char *output_take(NBT_Output *out, size_t *len) {
+  char *buf = out->buf;
+  *len = out->len;
+  out->buf = NULL;
+  out->len = 0;
+  out->capacity = 0;
+  return buf;
+}
+
+int output_release(NBT_Output *out) {
+  int result = output_flush(out);
+  free(out->buf);
+  out->buf = NULL;
+  out->capacity = 0;
+  return result;
+}
+
+char *output_reserve(NBT_Output *out, size_t n) {
+  if (out->capacity - out->len >= n) {
+    return out->buf + out->len;
+  }
+  if (out->fd >= 0) {
+    output_flush(out);
+    if (out->capacity >= n) {
+      return out->buf;
+    }
+  }
+
+  size_t capacity = out->capacity ? out->capacity : 4096;
+  while (capacity - out->len < n) {
+    capacity *= 2;
+  }
+  char *buf = realloc(out->buf, capacity);
+  if (buf == NULL) {
+    printf("Could not grow output buffer to %zu bytes\n", capacity);
+    out->failed = 1;
+    return NULL;
+  }
+  out->buf = buf;
+  out->capacity = capacity;
+  return out->buf + out->len;
+}
+
+void output_write(NBT_Output *out, const char *data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  char *dst = output_reserve(out, len);
+  if (dst == NULL) {
+    return;
+  }
+  memcpy(dst, data, len);
+  out->len += len;
+}
+
+void output_str(NBT_Output *out, const char *str) {
+  output_write(out, str, strlen(str));
+}
+
+void output_spaces(NBT_Output *out, int n) {
+  if (n <= 0) {
+    return;
+  }
+  char *dst = output_reserve(out, n);
+  if (dst == NULL) {
+    return;
+  }
+  memset(dst, ' ', n);
+  out->len += n;
+}
+
+static const char digit_pairs[] = "00010203040506070809"
+                                  "10111213141516171819"
+                                  "20212223242526272829"
+                                  "30313233343536373839"
+                                  "40414243444546474849"
+                                  "50515253545556575859"
+                                  "60616263646566676869"
+                                  "70717273747576777879"
+                                  "80818283848586878889"
+                                  "90919293949596979899";
+
+// writes the digits backwards from end, two at a time, returns the start
+static char *format_uint(char *end, uint64_t value) {
+  while (value >= 100) {
+    end -= 2;
+    memcpy(end, &digit_pairs[(value % 100) * 2], 2);
+    value /= 100;
+  }
+  if (value >= 10) {
+    end -= 2;
+    memcpy(end, &digit_pairs[value * 2], 2);
+  } else {
+    *--end = '0' + value;
+  }
+  return end;
+}
+
+void output_uint(NBT_Output *out, uint64_t value) {
+  char tmp[20];
+  char *start = format_uint(tmp + sizeof(tmp), value);
+  output_write(out, start, tmp + sizeof(tmp) - start);
+}
+
+void output_int(NBT_Output *out, int64_t value) {
+  if (value < 0) {
+    output_char(out, '-');
+    // negate in unsigned arithmetic so INT64_MIN works too
+    output_uint(out, -(uint64_t)value);
+  } else {
+    output_uint(out, value);
+  }
+}
+
+void output_hex(NBT_Output *out, uint64_t value) {
+  char tmp[16];
+  char *p = tmp + sizeof(tmp);
+  do {
+    *--p = "0123456789abcdef"[value & 15];
+    value >>= 4;
+  } while (value != 0);
+  output_write(out, p, tmp + sizeof(tmp) - p);
+}
+
+void output_fixed(NBT_Output *out, double value, int decimals) {
+  static const uint32_t scales[] = {1, 10, 100, 1000, 10000};
+  uint32_t scale = scales[decimals];
+  double scaled = fabs(value) * scale;
+
+  // Rounding the scaled value only gives printf's result when it is not
+  // close to a tie, the exact decimal expansion decides those. Huge values,
+  // infinities and NaN go to printf as well.
+  double fraction = scaled - floor(scaled);
+  if (!(scaled < 1e9) || fabs(fraction - 0.5) < 1e-6) {
+    char tmp[384];
+    int len = snprintf(tmp, sizeof(tmp), "%.*f", decimals, value);
+    output_write(out, tmp,
+                 len < (int)sizeof(tmp) ? (size_t)len : sizeof(tmp) - 1);
+    return;
+  }
+
+  uint64_t rounded = (uint64_t)(scaled + 0.5);
+  if (signbit(value)) {
+    output_char(out, '-');
+  }
+  output_uint(out, rounded / scale);
+  if (decimals > 0) {
+    char tmp[5];
+    uint32_t frac = rounded % scale;
+    for (int i = decimals - 1; i >= 0; i--) {
+      tmp[i] = '0' + frac % 10;
+      frac /= 10;
+    }
+    output_char(out, '.');
+    output_write(out, tmp, decimals);
+  }
+}
+
+// Tries "%.*g" from min digits up until the text reads back as the same
+// value. Integral values, the most common ones in game data, skip printf.
+static void output_shortest(NBT_Output *out, double value, int min, int max,
+                            int single) {
+  if (fabs(value) < 1e15 && value == (double)(int64_t)value) {
+    if (value == 0 && signbit(value)) {
+      output_char(out, '-');
+    }
+    output_int(out, (int64_t)value);
+    output_write(out, ".0", 2);
+    return;
+  }
+  char tmp[32];
+  int len;
+  for (int digits = min;; digits++) {
+    len = snprintf(tmp, sizeof(tmp), "%.*g", digits, value);
+    if (digits == max || (single ? strtof(tmp, NULL) == (float)value
+                                 : strtod(tmp, NULL) == value)) {
+      break;
+    }
+  }
+  output_write(out, tmp, len);
+  if (strpbrk(tmp, ".en") == NULL) {
+    output_write(out, ".0", 2);
+  }
+}
+
+void output_double(NBT_Output *out, double value) {
+  output_shortest(out, value, 15, 17, 0);
+}
+
+void output_float(NBT_Output *out, float value) {
+  output_shortest(out, value, 6, 9, 1);
+}
@@ -0,0 +1,53 @@
+#ifndef NBT_OUTPUT_H
+#define NBT_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Output buffer with its own number formatting. Bound to a file descriptor
+// it is flushed with one large write() whenever it fills up, without one
+// it grows in memory and its contents are taken with output_take.
+typedef struct NBT_Output {
+  char *buf;
+  size_t len;
+  size_t capacity;
+  // -1 for an in-memory buffer
+  int fd;
+  // set once a write() failed, later output is dropped
+  int failed;
+} NBT_Output;
+
+#define NBT_OUTPUT_SIZE (1024 * 1024)
+
+int output_init_fd(NBT_Output *out, int fd, size_t capacity);
+int output_init_memory(NBT_Output *out, size_t capacity);
+int output_flush(NBT_Output *out);
+// Hands the in-memory contents to the caller and leaves the buffer empty
+char *output_take(NBT_Output *out, size_t *len);
+// Flushes a descriptor bound buffer and frees it
+int output_release(NBT_Output *out);
+
+// Makes room for n more bytes, returns NULL if that is not possible
+char *output_reserve(NBT_Output *out, size_t n);
+void output_write(NBT_Output *out, const char *data, size_t len);
+void output_str(NBT_Output *out, const char *str);
+void output_spaces(NBT_Output *out, int n);
+void output_int(NBT_Output *out, int64_t value);
+void output_uint(NBT_Output *out, uint64_t value);
+void output_hex(NBT_Output *out, uint64_t value);
+// Same text as printf("%.*f", decimals, value), decimals at most 4
+void output_fixed(NBT_Output *out, double value, int decimals);
+// Fewest digits that read back as the same value, with at least one decimal
+// ("64.0", "0.1", "1e-07"). Infinities and NaN come out as printf has them.
+void output_double(NBT_Output *out, double value);
+void output_float(NBT_Output *out, float value);
+
+static inline void output_char(NBT_Output *out, char c) {
+  if (out->len < out->capacity) {
+    out->buf[out->len++] = c;
+  } else {
+    output_write(out, &c, 1);
+  }
+}
+
+#endif // NBT_OUTPUT_H
@@ -1,246 +1,195 @@
 #include "parser.h"
+#include "bswap.h"
+#include "cursor.h"
+#include "events.h"
+#include "index.h"
+#include "snbt.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
-int print_tags = 1;
-
-#define PRINT_TAG(...)                                                         \
-  if (print_tags) {                                                            \
-    printf(__VA_ARGS__);                                                       \
-  }
-
-inline uint16_t get_len_short(uint8_t *buf, long *pos) {
-  uint16_t val = (buf[*pos] << 8) | buf[*pos + 1];
-  *pos += 2;
-  return val;
-}
-
-// for getting tag name/text content
-inline char *get_text_short(uint8_t *buf, long *pos, uint16_t len) {
-
-  char *name = malloc(len + 1);
-  if (name == NULL) {
-    return NULL;
-  }
-
-  memcpy(name, &buf[*pos], len);
-  name[len] = '\0';
-
-  *pos += len;
-  return name;
+static void init_compound_value(NBT_Arena *arena, NBT_Tag *tag) {
+  // length and capacity is dynamic since we cannot know
+  // how big the compound is until we reach the END tag
+  tag->value.compound_value.length = 0;
+  tag->value.compound_value.capacity = 8;
+  tag->value.compound_value.elements = arena_alloc(arena, sizeof(NBT_Tag) * 8);
 }
 
-NBT_Tag *create_compound(NBT_Tag *previous, char *name, uint16_t name_len) {
-  NBT_Tag *tag = malloc(sizeof(NBT_Tag));
+NBT_Tag *create_compound(NBT_Arena *arena, char *name, uint16_t name_len) {
+  NBT_Tag *tag = arena_alloc(arena, sizeof(NBT_Tag));
   if (tag == NULL) {
-    printf("Could not allocate memory for tag %s", name);
+    printf("Could not allocate memory for tag %.*s", name_len, name);
+    return NULL;
   }
   tag->name = name;
   tag->tag_type = COMPOUND;
   tag->name_length = name_len;
-  tag->value.compound_value.previous = previous;
-  // length and capacity is dynamic since we cannot know
-  // how big the compound is until we reach the END tag
-  tag->value.compound_value.length = 0;
-  tag->value.compound_value.capacity = 8;
-  tag->value.compound_value.elements = malloc(sizeof(NBT_Tag) * 8);
+  tag->lazy = 0;
+  init_compound_value(arena, tag);
   return tag;
 }
 
-void add_tag_to_compound(NBT_Tag *compound, NBT_Tag *child) {
-  if (compound == NULL) {
-    printf("Cannot add tag to null compound");
-    exit(1);
-  }
-
-  if (compound->tag_type != COMPOUND) {
-    printf("The tag %s is not a compound tag, cannot add children",
-           compound->name);
-  }
-
+// returns the next unused element of compound, growing it when full
+static NBT_Tag *compound_next_slot(NBT_Arena *arena, NBT_Tag *compound) {
   if (compound->value.compound_value.capacity ==
       compound->value.compound_value.length) {
-    NBT_Tag *new_elements =
-        realloc(compound->value.compound_value.elements,
-                sizeof(NBT_Tag) * compound->value.compound_value.capacity * 2);
+    // the old array stays in the arena until the document is freed
+    NBT_Tag *new_elements = arena_alloc(
+        arena, sizeof(NBT_Tag) * compound->value.compound_value.capacity * 2);
 
     if (new_elements == NULL) {
       printf("Failed to resize compound tag elements array\n");
       exit(1);
     }
 
+    memcpy(new_elements, compound->value.compound_value.elements,
+           sizeof(NBT_Tag) * compound->value.compound_value.length);
+
     compound->value.compound_value.elements = new_elements;
     compound->value.compound_value.capacity =
         compound->value.compound_value.capacity * 2;
   }
 
-  compound->value.compound_value
-      .elements[compound->value.compound_value.length++] = *child;
+  return &compound->value.compound_value
+              .elements[compound->value.compound_value.length++];
+}
+
+void add_tag_to_compound(NBT_Arena *arena, NBT_Tag *compound, NBT_Tag *child) {
+  if (compound == NULL) {
+    printf("Cannot add tag to null compound");
+    exit(1);
+  }
+
+  if (compound->tag_type != COMPOUND) {
+    printf("The tag %.*s is not a compound tag, cannot add children",
+           compound->name_length, compound->name);
+  }
 
-  free(child);
+  *compound_next_slot(arena, compound) = *child;
 }
 
 // Helper function for common tag initialization
-inline NBT_Tag *init_tag(enum TagType type, char *name, uint16_t name_len) {
-  NBT_Tag *tag = malloc(sizeof(NBT_Tag));
+inline NBT_Tag *init_tag(NBT_Arena *arena, enum TagType type, char *name,
+                         uint16_t name_len) {
+  NBT_Tag *tag = arena_alloc(arena, sizeof(NBT_Tag));
   if (tag == NULL) {
-    printf("Could not allocate memory for tag %s\n", name);
+    printf("Could not allocate memory for tag %.*s\n", name_len, name);
     return NULL;
   }
 
   tag->tag_type = type;
   tag->name = name;
   tag->name_length = name_len;
+  tag->lazy = 0;
   return tag;
 }
 
-// not really needed, so i didnt even check whether this is correct
-void free_tag(NBT_Tag *tag) {
-  if (tag == NULL) {
-    return;
+static void release_buffer(NBT_Document *doc) {
+  if ((doc->flags & NBT_PARSE_MAPPED) && doc->buffer != NULL) {
+    munmap(doc->buffer, doc->size);
+  } else {
+    free(doc->buffer);
   }
+  doc->buffer = NULL;
+}
 
-  free(tag->name);
-
-  switch (tag->tag_type) {
-  case STRING:
-    free(tag->value.string_value.data);
-    break;
-
-  case LIST:
-    // for (int i = 0; i < tag->value.list_value.length; i++) {
-    //   free_tag(&tag->value.list_value.elements[i]);
-    // }
-    free(tag->value.list_value.elements);
-    break;
-
-  case COMPOUND:
-    for (int i = 0; i < tag->value.compound_value.length; i++) {
-      free_tag(&tag->value.compound_value.elements[i]);
-    }
-    free(tag->value.compound_value.elements);
-    break;
-
-  case BYTE_ARRAY:
-    free(tag->value.byte_array.data);
-    break;
-
-  case INT_ARRAY:
-    free(tag->value.int_array.data);
-    break;
-
-  case LONG_ARRAY:
-    free(tag->value.long_array.data);
-    break;
-
-  // no additional memory to be freed here
-  case END:
-  case BYTE:
-  case SHORT:
-  case INT:
-  case LONG:
-  case FLOAT:
-  case DOUBLE:
-    break;
-
-  default:
-    printf("Warning: Unknown tag type %d in free_tag\n", tag->tag_type);
-    break;
+// everything a document owns lives in its arena (and its buffer in zero-copy
+// and lazy mode), so there is nothing to walk here
+void free_document(NBT_Document *doc) {
+  if (doc == NULL) {
+    return;
   }
-  free(tag);
+  arena_release(&doc->arena);
+  release_buffer(doc);
+  free(doc);
 }
 
-NBT_Tag *create_byte_tag(char *name, uint16_t name_len, int8_t value) {
-  NBT_Tag *tag = init_tag(BYTE, name, name_len);
+NBT_Tag *create_byte_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                         int8_t value) {
+  NBT_Tag *tag = init_tag(arena, BYTE, name, name_len);
   if (tag) {
     tag->value.byte_value = value;
   }
   return tag;
 }
 
-NBT_Tag *create_short_tag(char *name, uint16_t name_len, int16_t value) {
-  NBT_Tag *tag = init_tag(SHORT, name, name_len);
+NBT_Tag *create_short_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                          int16_t value) {
+  NBT_Tag *tag = init_tag(arena, SHORT, name, name_len);
   if (tag) {
     tag->value.short_value = value;
   }
   return tag;
 }
 
-NBT_Tag *create_int_tag(char *name, uint16_t name_len, int32_t value) {
-  NBT_Tag *tag = init_tag(INT, name, name_len);
+NBT_Tag *create_int_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                        int32_t value) {
+  NBT_Tag *tag = init_tag(arena, INT, name, name_len);
   if (tag) {
     tag->value.int_value = value;
   }
   return tag;
 }
 
-NBT_Tag *create_long_tag(char *name, uint16_t name_len, int64_t value) {
-  NBT_Tag *tag = init_tag(LONG, name, name_len);
+NBT_Tag *create_long_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                         int64_t value) {
+  NBT_Tag *tag = init_tag(arena, LONG, name, name_len);
   if (tag) {
     tag->value.long_value = value;
   }
   return tag;
 }
 
-NBT_Tag *create_float_tag(char *name, uint16_t name_len, float value) {
-  NBT_Tag *tag = init_tag(FLOAT, name, name_len);
+NBT_Tag *create_float_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                          float value) {
+  NBT_Tag *tag = init_tag(arena, FLOAT, name, name_len);
   if (tag) {
     tag->value.float_value = value;
   }
   return tag;
 }
 
-NBT_Tag *create_double_tag(char *name, uint16_t name_len, double value) {
-  NBT_Tag *tag = init_tag(DOUBLE, name, name_len);
+NBT_Tag *create_double_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                           double value) {
+  NBT_Tag *tag = init_tag(arena, DOUBLE, name, name_len);
   if (tag) {
     tag->value.double_value = value;
   }
   return tag;
 }
 
-// String tag
-NBT_Tag *create_string_tag(char *name, uint16_t name_len, const char *value,
-                           uint16_t value_len) {
-  NBT_Tag *tag = init_tag(STRING, name, name_len);
-  if (!tag)
-    return NULL;
+// String and array tags store the data pointer as given, it has to outlive
+// the tag, so it either comes from the same arena or from a buffer owned by
+// the document
 
-  tag->value.string_value.data = malloc(value_len + 1);
-  if (!tag->value.string_value.data) {
-    printf("Could not allocate memory for string value\n");
-    free_tag(tag);
+NBT_Tag *create_string_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                           char *value, uint16_t value_len) {
+  NBT_Tag *tag = init_tag(arena, STRING, name, name_len);
+  if (!tag)
     return NULL;
-  }
 
-  memcpy(tag->value.string_value.data, value, value_len);
-  tag->value.string_value.data[value_len] = '\0';
+  tag->value.string_value.data = value;
   tag->value.string_value.length = value_len;
   return tag;
 }
 
-// Array tags
-NBT_Tag *create_byte_array_tag(char *name, uint16_t name_len, int8_t *data,
+NBT_Tag *create_byte_array_tag(NBT_Arena *arena, char *name,
+                               uint16_t name_len, int8_t *data,
                                int32_t length) {
-  NBT_Tag *tag = init_tag(BYTE_ARRAY, name, name_len);
+  NBT_Tag *tag = init_tag(arena, BYTE_ARRAY, name, name_len);
   if (!tag)
     return NULL;
 
-  tag->value.byte_array.data = malloc(length * sizeof(int8_t));
-  if (!tag->value.byte_array.data) {
-    printf("Could not allocate memory for byte array\n");
-    free_tag(tag);
-    return NULL;
-  }
-
-  memcpy(tag->value.byte_array.data, data, length * sizeof(int8_t));
+  tag->value.byte_array.data = data;
   tag->value.byte_array.length = length;
   return tag;
 }
 
-NBT_Tag *create_int_array_tag(char *name, uint16_t name_len, int32_t *data,
-                              int32_t length) {
-  NBT_Tag *tag = init_tag(INT_ARRAY, name, name_len);
+NBT_Tag *create_int_array_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                              int32_t *data, int32_t length) {
+  NBT_Tag *tag = init_tag(arena, INT_ARRAY, name, name_len);
   if (!tag)
     return NULL;
 
@@ -249,9 +198,10 @@ NBT_Tag *create_int_array_tag(char *name, uint16_t name_len, int32_t *data,
   return tag;
 }
 
-NBT_Tag *create_long_array_tag(char *name, uint16_t name_len, int64_t *data,
+NBT_Tag *create_long_array_tag(NBT_Arena *arena, char *name,
+                               uint16_t name_len, int64_t *data,
                                int32_t length) {
-  NBT_Tag *tag = init_tag(LONG_ARRAY, name, name_len);
+  NBT_Tag *tag = init_tag(arena, LONG_ARRAY, name, name_len);
   if (!tag)
     return NULL;
 
@@ -260,10 +210,10 @@ NBT_Tag *create_long_array_tag(char *name, uint16_t name_len, int64_t *data,
   return tag;
 }
 
-NBT_Tag *create_list_tag(char *name, uint16_t name_len,
+NBT_Tag *create_list_tag(NBT_Arena *arena, char *name, uint16_t name_len,
                          enum TagType element_type, int32_t list_len,
                          NBT_Tag *tags) {
-  NBT_Tag *tag = init_tag(LIST, name, name_len);
+  NBT_Tag *tag = init_tag(arena, LIST, name, name_len);
   if (!tag)
     return NULL;
 
@@ -273,443 +223,646 @@ NBT_Tag *create_list_tag(char *name, uint16_t name_len,
   return tag;
 }
 
-// shifts change the endianness
+// Tree builder, the NBT_Handler behind parse(). Children are written straight
+// into the element array of the compound or list that is open.
 
-inline int32_t get_int(uint8_t *buf, long *pos) {
-  int32_t value = (buf[*pos] << 24) | (buf[*pos + 1] << 16) |
-                  (buf[*pos + 2] << 8) | buf[*pos + 3];
-  *pos += 4;
-  return value;
+typedef struct TreeBuilder {
+  NBT_Document *doc;
+  NBT_Tag *open[NBT_MAX_DEPTH + 1];
+  // next element to fill, for open lists
+  int32_t next_index[NBT_MAX_DEPTH + 1];
+  int depth;
+  // array tag whose payload is still arriving
+  NBT_Tag *array;
+  int32_t array_filled;
+} TreeBuilder;
+
+static char *builder_text(TreeBuilder *b, const char *text, uint16_t len) {
+  if (text == NULL) {
+    return NULL;
+  }
+  // the walked buffer belongs to the document in zero-copy mode
+  if (b->doc->flags & NBT_PARSE_ZERO_COPY) {
+    return (char *)text;
+  }
+  return arena_strndup(&b->doc->arena, text, len);
 }
 
-inline int16_t get_short(uint8_t *buf, long *pos) {
-  int16_t value = (buf[*pos + 1] << 8) | buf[*pos];
-  *pos += 2;
-  return value;
+static char *builder_name(TreeBuilder *b, const char *name, uint16_t len) {
+  if (name != NULL && b->doc->names != NULL) {
+    return (char *)intern_name(b->doc->names, name, len);
+  }
+  return builder_text(b, name, len);
 }
 
-inline float get_float(uint8_t *buf, long *pos) {
-  uint32_t value = ((uint32_t)buf[*pos] << 24) |
-                   ((uint32_t)buf[*pos + 1] << 16) |
-                   ((uint32_t)buf[*pos + 2] << 8) | (uint32_t)buf[*pos + 3];
-  float result;
-  memcpy(&result, &value, 4);
-  *pos += 4;
-  return result;
+static NBT_Tag *builder_slot(TreeBuilder *b, enum TagType type,
+                             const char *name, uint16_t name_len) {
+  NBT_Tag *tag;
+  if (b->depth == 0) {
+    tag = arena_alloc(&b->doc->arena, sizeof(NBT_Tag));
+    if (tag != NULL && b->doc->root == NULL) {
+      b->doc->root = tag;
+    }
+  } else {
+    NBT_Tag *parent = b->open[b->depth - 1];
+    if (parent->tag_type == LIST) {
+      tag = &parent->value.list_value
+                 .elements[b->next_index[b->depth - 1]++];
+    } else {
+      tag = compound_next_slot(&b->doc->arena, parent);
+    }
+  }
+
+  if (tag == NULL) {
+    printf("Could not allocate memory for tag %.*s\n", name_len, name);
+    return NULL;
+  }
+  tag->tag_type = type;
+  tag->name = builder_name(b, name, name_len);
+  tag->name_length = name_len;
+  tag->lazy = 0;
+  return tag;
 }
 
-inline int8_t get_byte(uint8_t *buf, long *pos) {
-  int8_t value = buf[*pos];
-  *pos += 1;
-  return value;
+static int build_begin_compound(void *ctx, const char *name,
+                                uint16_t name_len) {
+  TreeBuilder *b = ctx;
+  NBT_Tag *tag = builder_slot(b, COMPOUND, name, name_len);
+  if (tag == NULL) {
+    return 1;
+  }
+  init_compound_value(&b->doc->arena, tag);
+  b->next_index[b->depth] = 0;
+  b->open[b->depth++] = tag;
+  return 0;
+}
+
+static int build_end(void *ctx) {
+  TreeBuilder *b = ctx;
+  NBT_Tag *tag = b->open[--b->depth];
+  // the element array of a closed compound no longer moves, its index
+  // stays valid
+  if ((b->doc->flags & NBT_PARSE_INDEX) && tag->tag_type == COMPOUND) {
+    compound_index(b->doc, tag);
+  }
+  return 0;
 }
 
-inline int64_t get_long(uint8_t *buf, long *pos) {
-  int64_t value =
-      ((int64_t)buf[*pos] << 56) | ((int64_t)buf[*pos + 1] << 48) |
-      ((int64_t)buf[*pos + 2] << 40) | ((int64_t)buf[*pos + 3] << 32) |
-      ((int64_t)buf[*pos + 4] << 24) | ((int64_t)buf[*pos + 5] << 16) |
-      ((int64_t)buf[*pos + 6] << 8) | (int64_t)buf[*pos + 7];
-  *pos += 8;
-  return value;
+static int build_scalar(void *ctx, const char *name, uint16_t name_len,
+                        enum TagType type, union NBT_Value value) {
+  NBT_Tag *tag = builder_slot(ctx, type, name, name_len);
+  if (tag == NULL) {
+    return 1;
+  }
+  tag->value = value;
+  return 0;
 }
 
-inline double get_double(uint8_t *buf, long *pos) {
-  uint64_t value =
-      ((uint64_t)buf[*pos] << 56) | ((uint64_t)buf[*pos + 1] << 48) |
-      ((uint64_t)buf[*pos + 2] << 40) | ((uint64_t)buf[*pos + 3] << 32) |
-      ((uint64_t)buf[*pos + 4] << 24) | ((uint64_t)buf[*pos + 5] << 16) |
-      ((uint64_t)buf[*pos + 6] << 8) | (uint64_t)buf[*pos + 7];
-  double result;
-  memcpy(&result, &value, 8);
-  *pos += 8;
-  return result;
+static int build_string(void *ctx, const char *name, uint16_t name_len,
+                        const char *value, uint16_t value_len) {
+  NBT_Tag *tag = builder_slot(ctx, STRING, name, name_len);
+  if (tag == NULL) {
+    return 1;
+  }
+  tag->value.string_value.data = builder_text(ctx, value, value_len);
+  tag->value.string_value.length = value_len;
+  return 0;
 }
 
-void parse_end_tag(NBT_Tag *current_compound, int *depth, long *pos) {
-  PRINT_TAG("%*s[END]\n", (*depth - 1) * 2, "");
-  if (current_compound && current_compound->value.compound_value.previous) {
-    current_compound = current_compound->value.compound_value.previous;
-    (*depth)--;
+static int build_array_begin(void *ctx, const char *name, uint16_t name_len,
+                             enum TagType type, int32_t length) {
+  TreeBuilder *b = ctx;
+  NBT_Tag *tag = builder_slot(b, type, name, name_len);
+  if (tag == NULL) {
+    return 1;
   }
-  (*pos)++;
+
+  void *data;
+  switch (type) {
+  case BYTE_ARRAY:
+    tag->value.byte_array.length = length;
+    // zero-copy byte arrays borrow the payload once it arrives
+    data = tag->value.byte_array.data =
+        (b->doc->flags & NBT_PARSE_ZERO_COPY)
+            ? NULL
+            : arena_alloc(&b->doc->arena, length * sizeof(int8_t));
+    break;
+  case INT_ARRAY:
+    tag->value.int_array.length = length;
+    data = tag->value.int_array.data =
+        arena_alloc(&b->doc->arena, length * sizeof(int32_t));
+    break;
+  default:
+    tag->value.long_array.length = length;
+    data = tag->value.long_array.data =
+        arena_alloc(&b->doc->arena, length * sizeof(int64_t));
+    break;
+  }
+  if (data == NULL &&
+      !(type == BYTE_ARRAY && (b->doc->flags & NBT_PARSE_ZERO_COPY))) {
+    printf("Failed to allocate memory for array elements\n");
+    return 1;
+  }
+
+  b->array = tag;
+  b->array_filled = 0;
+  return 0;
 }
 
-void parse_compound_tag(uint8_t buffer[], long *pos, int *depth,
-                        NBT_Tag **current_compound, NBT_Tag **root_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  PRINT_TAG("%*s[COMPOUND] %s\n", *depth * 2, "", name);
+static int build_array_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  TreeBuilder *b = ctx;
+  NBT_Tag *tag = b->array;
 
-  if (*root_compound == NULL) {
-    *root_compound = create_compound(NULL, name, name_len);
-    *current_compound = *root_compound;
-  } else {
-    NBT_Tag *new_compound = create_compound(*current_compound, name, name_len);
-    add_tag_to_compound(*current_compound, new_compound);
-    *current_compound =
-        &(*current_compound)
-             ->value.compound_value
-             .elements[(*current_compound)->value.compound_value.length - 1];
-  }
-  (*depth)++;
-}
-
-void parse_int_tag(uint8_t buffer[], long *pos, int depth,
-                   NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  int32_t value = get_int(buffer, pos);
-  PRINT_TAG("%*s[INT] %s = %d\n", depth * 2, "", name, value);
-  NBT_Tag *tag = create_int_tag(name, name_len, value);
-  add_tag_to_compound(current_compound, tag);
-}
-
-void parse_byte_tag(uint8_t buffer[], long *pos, int depth,
-                    NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  int8_t value = get_byte(buffer, pos);
-  PRINT_TAG("%*s[BYTE] %s = %hhx\n", depth * 2, "", name, value);
-  NBT_Tag *tag = create_byte_tag(name, name_len, value);
-  add_tag_to_compound(current_compound, tag);
-}
-
-void parse_float_tag(uint8_t buffer[], long *pos, int depth,
-                     NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  float value = get_float(buffer, pos);
-  PRINT_TAG("%*s[FLOAT] %s = %.2f\n", depth * 2, "", name, value);
-  NBT_Tag *tag = create_float_tag(name, name_len, value);
-  add_tag_to_compound(current_compound, tag);
-}
-
-void parse_double_tag(uint8_t buffer[], long *pos, int depth,
-                      NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  double value = get_double(buffer, pos);
-  PRINT_TAG("%*s[DOUBLE] %s = %.4f\n", depth * 2, "", name, value);
-  NBT_Tag *tag = create_double_tag(name, name_len, value);
-  add_tag_to_compound(current_compound, tag);
-}
-
-void parse_short_tag(uint8_t buffer[], long *pos, int depth,
-                     NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  int16_t value = get_short(buffer, pos);
-  PRINT_TAG("%*s[SHORT] %s = %hu\n", depth * 2, "", name, value);
-  NBT_Tag *tag = create_short_tag(name, name_len, value);
-  add_tag_to_compound(current_compound, tag);
-}
-
-void parse_long_tag(uint8_t buffer[], long *pos, int depth,
-                    NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  int64_t value = get_long(buffer, pos);
-  PRINT_TAG("%*s[LONG] %s = %lld\n", depth * 2, "", name, (long long)value);
-  NBT_Tag *tag = create_long_tag(name, name_len, value);
-  add_tag_to_compound(current_compound, tag);
-}
-
-void parse_string_tag(uint8_t buffer[], long *pos, int depth,
-                      NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  uint16_t str_len = get_len_short(buffer, pos);
-  char *string_content = get_text_short(buffer, pos, str_len);
-  PRINT_TAG("%*s[STRING] %s = %s\n", depth * 2, "", name, string_content);
-
-  NBT_Tag *str = create_string_tag(name, name_len, string_content, str_len);
-  add_tag_to_compound(current_compound, str);
-  free(string_content);
-}
-
-void parse_list_tag(uint8_t buffer[], long *pos, int depth,
-                    NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  enum TagType element_type = buffer[*pos];
-  (*pos)++;
-  int32_t list_size = get_int(buffer, pos);
-  NBT_Tag *elements = malloc(sizeof(NBT_Tag) * list_size);
-
-  if (!elements) {
-    printf("Failed to allocate memory for list elements\n");
-    free(name);
-    exit(1);
+  switch (tag->tag_type) {
+  case BYTE_ARRAY:
+    if (tag->value.byte_array.data == NULL) {
+      if (count == tag->value.byte_array.length) {
+        tag->value.byte_array.data = (int8_t *)data;
+        break;
+      }
+      tag->value.byte_array.data = arena_alloc(
+          &b->doc->arena, tag->value.byte_array.length * sizeof(int8_t));
+      if (tag->value.byte_array.data == NULL) {
+        printf("Failed to allocate memory for array elements\n");
+        return 1;
+      }
+    }
+    memcpy(tag->value.byte_array.data + b->array_filled, data, count);
+    break;
+  case INT_ARRAY:
+    bswap32_array((uint32_t *)tag->value.int_array.data + b->array_filled,
+                  data, count);
+    break;
+  default:
+    bswap64_array((uint64_t *)tag->value.long_array.data + b->array_filled,
+                  data, count);
+    break;
   }
 
-  PRINT_TAG("%*s[LIST] %s: length=%d\n", depth * 2, "", name, list_size);
+  b->array_filled += count;
+  return 0;
+}
 
-  for (int32_t i = 0; i < list_size; i++) {
-    switch (element_type) {
-    case BYTE: {
-      int8_t value = get_byte(buffer, pos);
-      elements[i] = *create_byte_tag(NULL, 0, value);
-      PRINT_TAG("%*s  [%d] = %d\n", depth * 2, "", i, value);
-      break;
+static int build_list_begin(void *ctx, const char *name, uint16_t name_len,
+                            enum TagType element_type, int32_t length) {
+  TreeBuilder *b = ctx;
+  NBT_Tag *tag = builder_slot(b, LIST, name, name_len);
+  if (tag == NULL) {
+    return 1;
+  }
+  tag->value.list_value.length = length;
+  tag->value.list_value.element_type = element_type;
+  int width = number_size(element_type);
+  if (width != 0) {
+    // numbers are packed, their chunks arrive through build_list_chunk.
+    // Zero-copy byte lists borrow the payload like byte arrays.
+    tag->value.list_value.values = NULL;
+    if (length &&
+        !(element_type == BYTE && (b->doc->flags & NBT_PARSE_ZERO_COPY))) {
+      tag->value.list_value.values =
+          arena_alloc(&b->doc->arena, (size_t)width * length);
+      if (tag->value.list_value.values == NULL) {
+        printf("Failed to allocate memory for list elements\n");
+        return 1;
+      }
     }
-    case SHORT: {
-      int16_t value = get_short(buffer, pos);
-      elements[i] = *create_short_tag(NULL, 0, value);
-      PRINT_TAG("%*s  [%d] = %d\n", depth * 2, "", i, value);
-      break;
+    b->array = tag;
+    b->array_filled = 0;
+  } else {
+    tag->value.list_value.elements =
+        length ? arena_alloc(&b->doc->arena, sizeof(NBT_Tag) * length)
+               : NULL;
+    if (length && tag->value.list_value.elements == NULL) {
+      printf("Failed to allocate memory for list elements\n");
+      return 1;
     }
-    case INT: {
-      int32_t value = get_int(buffer, pos);
-      elements[i] = *create_int_tag(NULL, 0, value);
-      PRINT_TAG("%*s  [%d] = %d\n", depth * 2, "", i, value);
-      break;
+  }
+  b->next_index[b->depth] = 0;
+  b->open[b->depth++] = tag;
+  return 0;
+}
+
+static int build_list_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  TreeBuilder *b = ctx;
+  NBT_Tag *tag = b->array;
+  int32_t length = tag->value.list_value.length;
+  char *values = tag->value.list_value.values;
+
+  switch (tag->value.list_value.element_type) {
+  case BYTE:
+    if (values == NULL) {
+      if (count == length) {
+        tag->value.list_value.values = (void *)data;
+        break;
+      }
+      values = arena_alloc(&b->doc->arena, length);
+      if (values == NULL) {
+        printf("Failed to allocate memory for list elements\n");
+        return 1;
+      }
+      tag->value.list_value.values = values;
     }
-    case LONG: {
-      int64_t value = get_long(buffer, pos);
-      elements[i] = *create_long_tag(NULL, 0, value);
-      PRINT_TAG("%*s  [%d] = %lld\n", depth * 2, "", i, (long long)value);
-      break;
+    memcpy(values + b->array_filled, data, count);
+    break;
+  case SHORT:
+    bswap16_array((uint16_t *)values + b->array_filled, data, count);
+    break;
+  case INT:
+  case FLOAT:
+    bswap32_array((uint32_t *)values + b->array_filled, data, count);
+    break;
+  default:
+    bswap64_array((uint64_t *)values + b->array_filled, data, count);
+    break;
+  }
+
+  b->array_filled += count;
+  return 0;
+}
+
+static const NBT_Handler tree_builder = {
+    .begin_compound = build_begin_compound,
+    .end_compound = build_end,
+    .scalar = build_scalar,
+    .string = build_string,
+    .array_begin = build_array_begin,
+    .array_chunk = build_array_chunk,
+    .list_begin = build_list_begin,
+    .list_chunk = build_list_chunk,
+    .list_end = build_end,
+};
+
+// Lazy documents. A lazy tag is decoded with the tree builder, one level at
+// a time: scalars, strings, arrays and packed lists are built as usual,
+// compounds and other lists get a lazy tag of their own and their payload is
+// jumped over.
+
+static int load_need(NBT_Cursor *c, long n) {
+  if (cursor_need(c, n) == NBT_CURSOR_OK) {
+    return 1;
+  }
+  printf("Unexpected end of data at position %ld\n", cursor_offset(c));
+  return 0;
+}
+
+// build_scalar that also records the offset of the payload
+static int load_scalar(TreeBuilder *b, const char *name, uint16_t name_len,
+                       enum TagType type, union NBT_Value value, long offset) {
+  NBT_Tag *tag = builder_slot(b, type, name, name_len);
+  if (tag == NULL) {
+    return NBT_WALK_ERROR;
+  }
+  tag->value = value;
+  tag->value.scalar.offset = offset;
+  return NBT_WALK_DONE;
+}
+
+// Builds the tag whose payload starts at the cursor into the next slot of
+// the builder and moves the cursor past it
+static int load_tag(TreeBuilder *b, NBT_Cursor *c, uint8_t type,
+                    const char *name, uint16_t name_len) {
+  long start = cursor_offset(c);
+  // a lazy root is checked once it is loaded, nothing follows it
+  int lazy_root = b->depth == 0 && (type == LIST || type == COMPOUND);
+  long end =
+      lazy_root ? start : nbt_skip(b->doc->buffer, b->doc->size, start, type);
+  if (end < 0) {
+    return NBT_WALK_ERROR;
+  }
+
+  NBT_Tag *tag;
+  union NBT_Value value;
+  switch (type) {
+  case BYTE:
+    value.byte_value = (int8_t)cursor_u8(c);
+    return load_scalar(b, name, name_len, type, value, start);
+  case SHORT:
+    value.short_value = (int16_t)cursor_u16(c);
+    return load_scalar(b, name, name_len, type, value, start);
+  case INT:
+    value.int_value = (int32_t)cursor_u32(c);
+    return load_scalar(b, name, name_len, type, value, start);
+  case LONG:
+    value.long_value = (int64_t)cursor_u64(c);
+    return load_scalar(b, name, name_len, type, value, start);
+  case FLOAT:
+    value.float_value = cursor_f32(c);
+    return load_scalar(b, name, name_len, type, value, start);
+  case DOUBLE:
+    value.double_value = cursor_f64(c);
+    return load_scalar(b, name, name_len, type, value, start);
+  case STRING: {
+    uint16_t len = cursor_u16(c);
+    return build_string(b, name, name_len, (const char *)cursor_skip(c, len),
+                        len);
+  }
+  case BYTE_ARRAY:
+  case INT_ARRAY:
+  case LONG_ARRAY: {
+    int32_t length = (int32_t)cursor_u32(c);
+    long width = type == BYTE_ARRAY ? 1 : type == INT_ARRAY ? 4 : 8;
+    if (build_array_begin(b, name, name_len, type, length) != 0) {
+      return NBT_WALK_ERROR;
     }
-    case FLOAT: {
-      float value = get_float(buffer, pos);
-      elements[i] = *create_float_tag(NULL, 0, value);
-      PRINT_TAG("%*s  [%d] = %.2f\n", depth * 2, "", i, value);
-      break;
+    return build_array_chunk(b, cursor_skip(c, length * width), length);
+  }
+  case LIST: {
+    uint8_t element_type = cursor_u8(c);
+    int32_t length = (int32_t)cursor_u32(c);
+    long bytes = (long)length * number_size(element_type);
+    if (number_size(element_type) != 0) {
+      // packed lists are leaves, decoding them costs no more than the jump
+      // over their payload
+      if (length < 0 || !load_need(c, bytes) ||
+          build_list_begin(b, name, name_len, element_type, length) != 0 ||
+          (length && build_list_chunk(b, cursor_skip(c, bytes), length))) {
+        return NBT_WALK_ERROR;
+      }
+      return build_end(b);
     }
-    case DOUBLE: {
-      double value = get_double(buffer, pos);
-      elements[i] = *create_double_tag(NULL, 0, value);
-      PRINT_TAG("%*s  [%d] = %.4f\n", depth * 2, "", i, value);
-      break;
+    tag = builder_slot(b, type, name, name_len);
+    if (tag == NULL) {
+      return NBT_WALK_ERROR;
     }
-    case STRING: {
-      uint16_t str_len = get_len_short(buffer, pos);
-      char *string_content = get_text_short(buffer, pos, str_len);
-      elements[i] = *create_string_tag(NULL, 0, string_content, str_len);
-      PRINT_TAG("%*s  [%d] = %s\n", depth * 2, "", i, string_content);
-      free(string_content);
-      break;
+    tag->lazy = 1;
+    tag->value.list_value.element_type = element_type;
+    tag->value.list_value.length = length;
+    tag->value.list_value.offset = cursor_offset(c);
+    break;
+  }
+  default:
+    tag = builder_slot(b, type, name, name_len);
+    if (tag == NULL) {
+      return NBT_WALK_ERROR;
     }
-    case BYTE_ARRAY: {
-      int32_t array_len = get_int(buffer, pos);
-      int8_t *data = malloc(array_len * sizeof(int8_t));
-      if (!data) {
-        printf("Failed to allocate memory for byte array in list\n");
-        free(elements);
-        free(name);
-        exit(1);
-      }
-      for (int32_t j = 0; j < array_len; j++) {
-        data[j] = get_byte(buffer, pos);
-      }
-      elements[i] = *create_byte_array_tag(NULL, 0, data, array_len);
-      PRINT_TAG("%*s  [%d] = byte[%d]\n", depth * 2, "", i, array_len);
-      free(data);
-      break;
+    tag->lazy = 1;
+    tag->value.compound_value.offset = start;
+    tag->value.compound_value.length = 0;
+    tag->value.compound_value.capacity = 0;
+    break;
+  }
+  if (!lazy_root) {
+    cursor_skip(c, end - cursor_offset(c));
+  }
+  return NBT_WALK_DONE;
+}
+
+// Only the header of the root tag is read, a compound or list root is not
+// looked at before it is loaded
+static int load_root(TreeBuilder *b) {
+  NBT_Cursor c;
+  cursor_init(&c, b->doc->buffer, b->doc->size);
+  // END bytes in front of the root tag carry no payload
+  while (cursor_remaining(&c) > 0 && *c.pos == END) {
+    cursor_skip(&c, 1);
+  }
+  if (cursor_remaining(&c) == 0) {
+    return NBT_WALK_DONE;
+  }
+  if (!load_need(&c, 3)) {
+    return NBT_WALK_ERROR;
+  }
+  uint8_t type = cursor_u8(&c);
+  uint16_t name_len = cursor_u16(&c);
+  if (type > LONG_ARRAY) {
+    printf("Unknown tag type %d at position 0 (0x0)\n", type);
+    return NBT_WALK_ERROR;
+  }
+  if (!load_need(&c, name_len + (type == LIST ? 5 : 0))) {
+    return NBT_WALK_ERROR;
+  }
+  const char *name = (const char *)cursor_skip(&c, name_len);
+  return load_tag(b, &c, type, name, name_len);
+}
+
+// Decodes the payload of a lazy compound or list one level deep
+static int load_elements(NBT_Document *doc, NBT_Tag *tag) {
+  TreeBuilder builder;
+  builder.doc = doc;
+  builder.depth = 1;
+  builder.array = NULL;
+  builder.open[0] = tag;
+  builder.next_index[0] = 0;
+
+  NBT_Cursor c;
+  cursor_init(&c, doc->buffer, doc->size);
+
+  if (tag->tag_type == LIST) {
+    long offset = tag->value.list_value.offset;
+    int32_t length = tag->value.list_value.length;
+    cursor_skip(&c, offset);
+    NBT_Tag *elements =
+        length ? arena_alloc(&doc->arena, sizeof(NBT_Tag) * length) : NULL;
+    if (length && elements == NULL) {
+      printf("Failed to allocate memory for list elements\n");
+      return NBT_WALK_ERROR;
     }
-    case INT_ARRAY: {
-      int32_t array_len = get_int(buffer, pos);
-      int32_t *data = malloc(array_len * sizeof(int32_t));
-      if (!data) {
-        printf("Failed to allocate memory for int array in list\n");
-        free(elements);
-        free(name);
-        exit(1);
-      }
-      for (int32_t j = 0; j < array_len; j++) {
-        data[j] = get_int(buffer, pos);
+    tag->value.list_value.elements = elements;
+    for (int32_t i = 0; i < length; i++) {
+      if (load_tag(&builder, &c, tag->value.list_value.element_type, NULL,
+                   0) != NBT_WALK_DONE) {
+        tag->value.list_value.offset = offset;
+        return NBT_WALK_ERROR;
       }
-      elements[i] = *create_int_array_tag(NULL, 0, data, array_len);
-      PRINT_TAG("%*s  [%d] = int[%d]\n", depth * 2, "", i, array_len);
-      free(data);
-      break;
     }
-    case LONG_ARRAY: {
-      int32_t array_len = get_int(buffer, pos);
-      int64_t *data = malloc(array_len * sizeof(int64_t));
-      if (!data) {
-        printf("Failed to allocate memory for long array in list\n");
-        free(elements);
-        free(name);
-        exit(1);
-      }
-      for (int32_t j = 0; j < array_len; j++) {
-        data[j] = get_long(buffer, pos);
-      }
-      elements[i] = *create_long_array_tag(NULL, 0, data, array_len);
-      PRINT_TAG("%*s  [%d] = long[%d]\n", depth * 2, "", i, array_len);
-      free(data);
+    tag->lazy = 0;
+    return NBT_WALK_DONE;
+  }
+
+  long offset = tag->value.compound_value.offset;
+  cursor_skip(&c, offset);
+  init_compound_value(&doc->arena, tag);
+  while (1) {
+    if (!load_need(&c, 1)) {
       break;
     }
-    case COMPOUND: {
-      // Handling compounds inside list
-      NBT_Tag *compound_tag = create_compound(NULL, NULL, 0);
-      if (!compound_tag) {
-        printf("Failed to create compound tag in list\n");
-        free(elements);
-        free(name);
-        exit(1);
-      }
-
-      int nested_depth = depth + 1;
-      PRINT_TAG("%*s  [%d] = compound\n", depth * 2, "", i);
-
-      // Parse nested compound
-      while (buffer[*pos] != END) {
-        uint8_t tag_type = buffer[*pos];
-        switch (tag_type) {
-        case BYTE:
-          parse_byte_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case SHORT:
-          parse_short_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case INT:
-          parse_int_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case LONG:
-          parse_long_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case FLOAT:
-          parse_float_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case DOUBLE:
-          parse_double_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case STRING:
-          parse_string_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case BYTE_ARRAY:
-          parse_byte_array_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case INT_ARRAY:
-          parse_int_array_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        case LONG_ARRAY:
-          parse_long_array_tag(buffer, pos, nested_depth + 1, compound_tag);
-          break;
-        default:
-          printf("Unexpected tag type %d in compound list element\n", tag_type);
-          free(elements);
-          free(name);
-          free_tag(compound_tag);
-          exit(1);
-        }
+    uint8_t type = cursor_u8(&c);
+    if (type == END) {
+      tag->lazy = 0;
+      // the element array is final, like that of a compound whose END tag
+      // the tree builder saw
+      if (doc->flags & NBT_PARSE_INDEX) {
+        compound_index(doc, tag);
       }
-      // Move past the END tag
-      (*pos)++;
-      elements[i] = *compound_tag;
-      free(compound_tag);
+      return NBT_WALK_DONE;
+    }
+    if (!load_need(&c, 2)) {
       break;
     }
-    case LIST: {
-      enum TagType nested_element_type = buffer[*pos];
-      (*pos)++;
-      int32_t nested_list_size = get_int(buffer, pos);
-      NBT_Tag *nested_elements = malloc(sizeof(NBT_Tag) * nested_list_size);
-      if (!nested_elements) {
-        printf("Failed to allocate memory for nested list\n");
-        free(elements);
-        free(name);
-        exit(1);
-      }
-
-      PRINT_TAG("%*s  [%d] = list[%d]\n", depth * 2, "", i, nested_list_size);
-
-      NBT_Tag *nested_list = create_list_tag(NULL, 0, nested_element_type,
-                                             nested_list_size, nested_elements);
-      if (!nested_list) {
-        printf("Failed to create nested list tag\n");
-        free(nested_elements);
-        free(elements);
-        free(name);
-        exit(1);
-      }
-
-      elements[i] = *nested_list;
-      free(nested_list);
+    uint16_t name_len = cursor_u16(&c);
+    if (!load_need(&c, name_len)) {
       break;
     }
-    default:
-      printf("Unsupported list element type: %d\n", element_type);
-      free(elements);
-      free(name);
-      exit(1);
+    const char *name = (const char *)cursor_skip(&c, name_len);
+    if (load_tag(&builder, &c, type, name, name_len) != NBT_WALK_DONE) {
+      break;
     }
   }
+  tag->value.compound_value.offset = offset;
+  tag->value.compound_value.length = 0;
+  tag->value.compound_value.capacity = 0;
+  return NBT_WALK_ERROR;
+}
 
-  NBT_Tag *list_tag =
-      create_list_tag(name, name_len, element_type, list_size, elements);
-  if (!list_tag) {
-    printf("Failed to create list tag\n");
-    free(elements);
-    free(name);
-    exit(1);
+NBT_Tag *tag_elements(NBT_Document *doc, NBT_Tag *tag, int32_t *length) {
+  if (tag->lazy && load_elements(doc, tag) != NBT_WALK_DONE) {
+    *length = -1;
+    return NULL;
+  }
+  if (tag->tag_type == LIST &&
+      number_size(tag->value.list_value.element_type) == 0) {
+    *length = tag->value.list_value.length;
+    return tag->value.list_value.elements;
   }
+  if (tag->tag_type == COMPOUND) {
+    *length = tag->value.compound_value.length;
+    return tag->value.compound_value.elements;
+  }
+  *length = 0;
+  return NULL;
+}
 
-  add_tag_to_compound(current_compound, list_tag);
+const void *list_values(const NBT_Tag *list, int32_t *length) {
+  if (list->tag_type != LIST ||
+      number_size(list->value.list_value.element_type) == 0) {
+    *length = 0;
+    return NULL;
+  }
+  *length = list->value.list_value.length;
+  return list->value.list_value.values;
 }
 
-void parse_byte_array_tag(uint8_t buffer[], long *pos, int depth,
-                          NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  int32_t length = get_int(buffer, pos);
-  int8_t *data = malloc(length * sizeof(int8_t));
+union NBT_Value list_number(const NBT_Tag *list, int32_t index) {
+  union NBT_Value value;
+  const void *values = list->value.list_value.values;
+  switch (list->value.list_value.element_type) {
+  case BYTE:
+    value.byte_value = ((const int8_t *)values)[index];
+    break;
+  case SHORT:
+    value.short_value = ((const int16_t *)values)[index];
+    break;
+  case INT:
+    value.int_value = ((const int32_t *)values)[index];
+    break;
+  case LONG:
+    value.long_value = ((const int64_t *)values)[index];
+    break;
+  case FLOAT:
+    value.float_value = ((const float *)values)[index];
+    break;
+  default:
+    value.double_value = ((const double *)values)[index];
+    break;
+  }
+  return value;
+}
 
-  for (int32_t i = 0; i < length; i++) {
-    data[i] = get_byte(buffer, pos);
+NBT_Document *create_document(size_t block_size) {
+  NBT_Document *doc = malloc(sizeof(NBT_Document));
+  if (doc == NULL) {
+    printf("Could not allocate memory for document\n");
+    return NULL;
+  }
+  arena_init(&doc->arena, block_size);
+  doc->root = NULL;
+  doc->flags = 0;
+  doc->buffer = NULL;
+  doc->size = 0;
+  doc->indexes = NULL;
+  doc->names = NULL;
+  return doc;
+}
+
+// Drops the tree the document holds and parses buffer into it, reusing the
+// memory of its arena. Used by workers that parse one input after another.
+// Returns -1 on malformed input, the buffer then stays with the caller.
+int parse_into(NBT_Document *doc, uint8_t buffer[], long size, int flags) {
+  release_buffer(doc);
+  arena_reset(&doc->arena);
+  doc->root = NULL;
+  doc->flags = flags;
+  doc->indexes = NULL;
+  doc->buffer = (flags & NBT_PARSE_OWNS_BUFFER) ? buffer : NULL;
+  doc->size = size;
+
+  TreeBuilder builder;
+  builder.doc = doc;
+  builder.depth = 0;
+  builder.array = NULL;
+
+  int result = (flags & NBT_PARSE_LAZY)
+                   ? load_root(&builder)
+                   : nbt_walk(buffer, size, &tree_builder, &builder);
+  if (result != NBT_WALK_DONE) {
+    doc->buffer = NULL;
+    doc->root = NULL;
+    return -1;
   }
+  return 0;
+}
 
-  PRINT_TAG("%*s[BYTE_ARRAY] %s: length=%d\n", depth * 2, "", name, length);
-  NBT_Tag *array_tag = create_byte_array_tag(name, name_len, data, length);
-  add_tag_to_compound(current_compound, array_tag);
-  free(data);
+// The returned document owns the whole tree, release it with free_document.
+// With NBT_PARSE_ZERO_COPY or NBT_PARSE_LAZY the document also takes
+// ownership of buffer.
+// Returns NULL on malformed input, the buffer then stays with the caller.
+NBT_Document *parse(uint8_t buffer[], long size, int flags) {
+  return parse_with_names(buffer, size, flags, NULL);
 }
 
-void parse_int_array_tag(uint8_t buffer[], long *pos, int depth,
-                         NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  int32_t length = get_int(buffer, pos);
-  int32_t *data = malloc(length * sizeof(int32_t));
+// Same with the names of the tree interned in names, which has to outlive
+// the document
+NBT_Document *parse_with_names(uint8_t buffer[], long size, int flags,
+                               NBT_NameTable *names) {
+  // sized from the input so small files fit in a single block
+  NBT_Document *doc = create_document(size > 4096 ? size : 4096);
+  if (doc == NULL) {
+    return NULL;
+  }
+  doc->names = names;
+  if (parse_into(doc, buffer, size, flags) != 0) {
+    free_document(doc);
+    return NULL;
+  }
+  return doc;
+}
 
-  for (int32_t i = 0; i < length; i++) {
-    data[i] = get_int(buffer, pos);
+// Builds the tree while pulling the input through a window, the input itself
+// is never held in memory as a whole. Everything is copied into the arena.
+NBT_Document *parse_stream(NBT_ReadFn read, void *source, long window) {
+  NBT_Document *doc = create_document(0);
+  if (doc == NULL) {
+    return NULL;
   }
 
-  PRINT_TAG("%*s[INT_ARRAY] %s: length=%d\n", depth * 2, "", name, length);
-  NBT_Tag *array_tag = create_int_array_tag(name, name_len, data, length);
-  add_tag_to_compound(current_compound, array_tag);
-  free(data);
-}
+  TreeBuilder builder;
+  builder.doc = doc;
+  builder.depth = 0;
+  builder.array = NULL;
 
-void parse_long_array_tag(uint8_t buffer[], long *pos, int depth,
-                          NBT_Tag *current_compound) {
-  (*pos)++;
-  uint16_t name_len = get_len_short(buffer, pos);
-  char *name = get_text_short(buffer, pos, name_len);
-  int32_t length = get_int(buffer, pos);
-  int64_t *data = malloc(length * sizeof(int64_t));
+  if (nbt_walk_stream(read, source, window, &tree_builder, &builder) !=
+      NBT_WALK_DONE) {
+    free_document(doc);
+    return NULL;
+  }
+  return doc;
+}
 
-  for (int32_t i = 0; i < length; i++) {
-    data[i] = get_long(buffer, pos);
+// Builds the tree of SNBT text, names and strings are copied into the arena
+NBT_Document *parse_snbt(const char *text, long len) {
+  NBT_Document *doc = create_document(0);
+  if (doc == NULL) {
+    return NULL;
   }
 
-  PRINT_TAG("%*s[LONG_ARRAY] %s: length=%d\n", depth * 2, "", name, length);
-  NBT_Tag *array_tag = create_long_array_tag(name, name_len, data, length);
-  add_tag_to_compound(current_compound, array_tag);
-  free(data);
+  TreeBuilder builder;
+  builder.doc = doc;
+  builder.depth = 0;
+  builder.array = NULL;
+
+  if (snbt_walk(text, len, &tree_builder, &builder) != NBT_WALK_DONE) {
+    free_document(doc);
+    return NULL;
+  }
+  return doc;
 }
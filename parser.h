@@ -1,6 +1,8 @@
 #ifndef NBT_TAGS_H
 #define NBT_TAGS_H
 
+#include "arena.h"
+#include "names.h"
 #include <stdint.h>
 
 // Tag type enumeration
@@ -45,87 +47,151 @@ union NBT_Value {
     int64_t *data;
     int32_t length;
   } long_array;
+  // Lists and compounds of a lazy document are read through tag_elements.
+  // Until then they only hold the offset of their first element or child in
+  // the document's buffer, a lazy list already knows its length.
+  // Lists of BYTE to DOUBLE are packed instead: values holds the numbers in
+  // host order, typed by element_type like the data of an array tag, and
+  // there is no NBT_Tag per element. They are never lazy.
   struct {
-    struct NBT_Tag *elements;
+    union {
+      struct NBT_Tag *elements;
+      void *values;
+      long offset;
+    };
     int32_t length;
     enum TagType element_type;
   } list_value;
   struct {
-    struct NBT_Tag *previous;
-    struct NBT_Tag *elements;
+    union {
+      struct NBT_Tag *elements;
+      long offset;
+    };
     // Compounds do not normally have length nor capacity fields, these
     // are for parsing purposes only.
     int32_t length;
     int32_t capacity;
   } compound_value;
+  // Scalars of a lazy document also keep where their payload starts in the
+  // document's buffer, which edit_tag patches. value overlaps the scalar
+  // fields above.
+  struct {
+    int64_t value;
+    long offset;
+  } scalar;
 };
 
+// Size of a BYTE to DOUBLE payload, 0 for every other type
+static inline int number_size(enum TagType type) {
+  static const uint8_t sizes[] = {
+      [BYTE] = 1, [SHORT] = 2, [INT] = 4, [LONG] = 8, [FLOAT] = 4, [DOUBLE] = 8,
+  };
+  return type >= BYTE && type <= DOUBLE ? sizes[type] : 0;
+}
+
 // NBT Tag structure
 typedef struct NBT_Tag {
   enum TagType tag_type;
   uint16_t name_length;
+  // compound or list whose payload is not decoded yet
+  uint8_t lazy;
   char *name;
   union NBT_Value value;
 } NBT_Tag;
 
-void parse_end_tag(NBT_Tag *current_compound, int *depth, long *pos);
-void parse_compound_tag(uint8_t buffer[], long *pos, int *depth,
-                        NBT_Tag **current_compound, NBT_Tag **root_compound);
-void parse_int_tag(uint8_t buffer[], long *pos, int depth,
-                   NBT_Tag *current_compound);
-void parse_byte_tag(uint8_t buffer[], long *pos, int depth,
-                    NBT_Tag *current_compound);
-void parse_float_tag(uint8_t buffer[], long *pos, int depth,
-                     NBT_Tag *current_compound);
-void parse_double_tag(uint8_t buffer[], long *pos, int depth,
-                      NBT_Tag *current_compound);
-void parse_short_tag(uint8_t buffer[], long *pos, int depth,
-                     NBT_Tag *current_compound);
-void parse_long_tag(uint8_t buffer[], long *pos, int depth,
-                    NBT_Tag *current_compound);
-void parse_string_tag(uint8_t buffer[], long *pos, int depth,
-                      NBT_Tag *current_compound);
-void parse_list_tag(uint8_t buffer[], long *pos, int depth,
-                    NBT_Tag *current_compound);
-void parse_byte_array_tag(uint8_t buffer[], long *pos, int depth,
-                          NBT_Tag *current_compound);
-void parse_int_array_tag(uint8_t buffer[], long *pos, int depth,
-                         NBT_Tag *current_compound);
-void parse_long_array_tag(uint8_t buffer[], long *pos, int depth,
-                          NBT_Tag *current_compound);
+enum NBT_ParseFlags {
+  // names, strings and byte arrays point into the input buffer instead of
+  // being copied, names and strings are then NOT NUL terminated
+  NBT_PARSE_ZERO_COPY = 1 << 0,
+  // build the child index of every large compound while parsing instead of
+  // on its first lookup, see index.h
+  NBT_PARSE_INDEX = 1 << 1,
+  // only the root tag is decoded, every compound and list is decoded on its
+  // first tag_elements call and then kept. Scalar edits are written straight
+  // into the buffer, see edit_tag.
+  NBT_PARSE_LAZY = 1 << 2,
+  // the buffer is a mapping of a whole file (see open_input in file.h), a
+  // document that takes ownership of it unmaps it instead of freeing it
+  NBT_PARSE_MAPPED = 1 << 3,
+};
+
+// the document keeps the input buffer and frees it with the tree
+#define NBT_PARSE_OWNS_BUFFER (NBT_PARSE_ZERO_COPY | NBT_PARSE_LAZY)
+
+// A parsed document. Every tag, name, string and array of the tree is
+// allocated from the document's arena. In zero-copy and lazy mode the
+// document also takes ownership of the input buffer the tree borrows from.
+typedef struct NBT_Document {
+  NBT_Arena arena;
+  NBT_Tag *root;
+  int flags;
+  uint8_t *buffer;
+  long size;
+  // child indexes of compounds, NULL until the first one is built
+  struct NBT_IndexMap *indexes;
+  // when set, every name of the tree points into this table, see names.h.
+  // The document does not own it.
+  NBT_NameTable *names;
+} NBT_Document;
 
-// Tag creation functions
-NBT_Tag *create_compound(NBT_Tag *previous, char *name, uint16_t name_len);
-NBT_Tag *create_byte_tag(char *name, uint16_t name_len, int8_t value);
-NBT_Tag *create_short_tag(char *name, uint16_t name_len, int16_t value);
-NBT_Tag *create_int_tag(char *name, uint16_t name_len, int32_t value);
-NBT_Tag *create_long_tag(char *name, uint16_t name_len, int64_t value);
-NBT_Tag *create_float_tag(char *name, uint16_t name_len, float value);
-NBT_Tag *create_double_tag(char *name, uint16_t name_len, double value);
-NBT_Tag *create_string_tag(char *name, uint16_t name_len, const char *value,
-                           uint16_t value_len);
-NBT_Tag *create_byte_array_tag(char *name, uint16_t name_len, int8_t *data,
+// Pulls up to len bytes into dst, returns how many were read, 0 at the end
+// of the input and -1 on errors
+typedef long (*NBT_ReadFn)(void *source, uint8_t *dst, long len);
+
+// Builds the tree of a whole buffer, see parse() in parser.c
+NBT_Document *parse(uint8_t buffer[], long size, int flags);
+NBT_Document *parse_with_names(uint8_t buffer[], long size, int flags,
+                               NBT_NameTable *names);
+NBT_Document *create_document(size_t block_size);
+int parse_into(NBT_Document *doc, uint8_t buffer[], long size, int flags);
+NBT_Document *parse_stream(NBT_ReadFn read, void *source, long window);
+// Builds the tree of SNBT text, see snbt.h. Every root after the first is
+// dropped.
+NBT_Document *parse_snbt(const char *text, long len);
+
+// Children of a compound or elements of a list, with their number in
+// *length. A lazy tag is decoded one level deep on the first call, its
+// compounds and lists stay lazy. Returns NULL and sets *length to -1 if the
+// payload turns out to be malformed.
+NBT_Tag *tag_elements(NBT_Document *doc, NBT_Tag *tag, int32_t *length);
+// Packed lists have no element tags, tag_elements returns NULL and a length
+// of 0 for them. Their numbers are read through list_values, in bulk with
+// their count in *length (0 for lists that are not packed), or list_number
+// one at a time.
+const void *list_values(const NBT_Tag *list, int32_t *length);
+union NBT_Value list_number(const NBT_Tag *list, int32_t index);
+
+// Tag creation functions, all tags are allocated from the given arena
+NBT_Tag *create_compound(NBT_Arena *arena, char *name, uint16_t name_len);
+NBT_Tag *create_byte_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                         int8_t value);
+NBT_Tag *create_short_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                          int16_t value);
+NBT_Tag *create_int_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                        int32_t value);
+NBT_Tag *create_long_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                         int64_t value);
+NBT_Tag *create_float_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                          float value);
+NBT_Tag *create_double_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                           double value);
+NBT_Tag *create_string_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                           char *value, uint16_t value_len);
+NBT_Tag *create_byte_array_tag(NBT_Arena *arena, char *name,
+                               uint16_t name_len, int8_t *data,
                                int32_t length);
-NBT_Tag *create_int_array_tag(char *name, uint16_t name_len, int32_t *data,
-                              int32_t length);
-NBT_Tag *create_long_array_tag(char *name, uint16_t name_len, int64_t *data,
+NBT_Tag *create_int_array_tag(NBT_Arena *arena, char *name, uint16_t name_len,
+                              int32_t *data, int32_t length);
+NBT_Tag *create_long_array_tag(NBT_Arena *arena, char *name,
+                               uint16_t name_len, int64_t *data,
                                int32_t length);
-NBT_Tag *create_list_tag(char *name, uint16_t name_len,
+NBT_Tag *create_list_tag(NBT_Arena *arena, char *name, uint16_t name_len,
                          enum TagType element_type, int32_t list_len,
                          NBT_Tag *tags);
 
-NBT_Tag *init_tag(enum TagType type, char *name, uint16_t name_len);
-void free_tag(NBT_Tag *tag);
-void add_tag_to_compound(NBT_Tag *compound, NBT_Tag *child);
-
-// Helper / utility functions
-uint16_t get_len_short(uint8_t *buf, long *pos);
-char *get_text_short(uint8_t *buf, long *pos, uint16_t len);
-int32_t get_int(uint8_t *buf, long *pos);
-int16_t get_short(uint8_t *buf, long *pos);
-float get_float(uint8_t *buf, long *pos);
-int8_t get_byte(uint8_t *buf, long *pos);
-int64_t get_long(uint8_t *buf, long *pos);
-double get_double(uint8_t *buf, long *pos);
+NBT_Tag *init_tag(NBT_Arena *arena, enum TagType type, char *name,
+                  uint16_t name_len);
+void add_tag_to_compound(NBT_Arena *arena, NBT_Tag *compound, NBT_Tag *child);
+void free_document(NBT_Document *doc);
 
 #endif // NBT_TAGS_H
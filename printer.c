@@ -0,0 +1,252 @@
+#include "printer.h"
+#include <stdio.h>
+#include <unistd.h>
+
+int print_tags = 1;
+
+static PrintFrame *current_frame(NBT_Printer *p) { return &p->frames[p->top]; }
+
+static void push_frame(NBT_Printer *p, int depth, int in_list, int print_end) {
+  PrintFrame *frame = &p->frames[++p->top];
+  frame->depth = depth;
+  frame->in_list = in_list;
+  frame->print_end = print_end;
+  frame->index = 0;
+}
+
+// "  [i] = " in front of a list element, one step in from the list
+static void print_element(NBT_Printer *p, PrintFrame *frame) {
+  output_spaces(p->out, frame->depth * 2 + 2);
+  output_char(p->out, '[');
+  output_int(p->out, frame->index++);
+  output_str(p->out, "] = ");
+}
+
+// "[LABEL] name" in front of a named tag
+static void print_label(NBT_Printer *p, PrintFrame *frame, const char *label,
+                        const char *name, uint16_t name_len) {
+  output_spaces(p->out, frame->depth * 2);
+  output_str(p->out, label);
+  output_write(p->out, name, name_len);
+}
+
+static int print_begin_compound(void *ctx, const char *name,
+                                uint16_t name_len) {
+  NBT_Printer *p = ctx;
+  PrintFrame *frame = current_frame(p);
+  if (frame->in_list) {
+    print_element(p, frame);
+    output_str(p->out, "compound\n");
+    push_frame(p, frame->depth + 2, 0, 0);
+  } else {
+    print_label(p, frame, "[COMPOUND] ", name, name_len);
+    output_char(p->out, '\n');
+    push_frame(p, frame->depth + 1, 0, 1);
+  }
+  return 0;
+}
+
+static int print_end_compound(void *ctx) {
+  NBT_Printer *p = ctx;
+  PrintFrame *frame = current_frame(p);
+  if (frame->print_end) {
+    output_spaces(p->out, (frame->depth - 1) * 2);
+    output_str(p->out, "[END]\n");
+  }
+  p->top--;
+  return 0;
+}
+
+static int print_scalar(void *ctx, const char *name, uint16_t name_len,
+                        enum TagType type, union NBT_Value value) {
+  NBT_Printer *p = ctx;
+  PrintFrame *frame = current_frame(p);
+  NBT_Output *out = p->out;
+
+  if (frame->in_list) {
+    print_element(p, frame);
+    switch (type) {
+    case BYTE:
+      output_int(out, value.byte_value);
+      break;
+    case SHORT:
+      output_int(out, value.short_value);
+      break;
+    case INT:
+      output_int(out, value.int_value);
+      break;
+    case LONG:
+      output_int(out, value.long_value);
+      break;
+    case FLOAT:
+      output_fixed(out, value.float_value, 2);
+      break;
+    default:
+      output_fixed(out, value.double_value, 4);
+      break;
+    }
+    output_char(out, '\n');
+    return 0;
+  }
+
+  // bytes are shown in hex and shorts unsigned
+  switch (type) {
+  case BYTE:
+    print_label(p, frame, "[BYTE] ", name, name_len);
+    output_str(out, " = ");
+    output_hex(out, (uint8_t)value.byte_value);
+    break;
+  case SHORT:
+    print_label(p, frame, "[SHORT] ", name, name_len);
+    output_str(out, " = ");
+    output_uint(out, (uint16_t)value.short_value);
+    break;
+  case INT:
+    print_label(p, frame, "[INT] ", name, name_len);
+    output_str(out, " = ");
+    output_int(out, value.int_value);
+    break;
+  case LONG:
+    print_label(p, frame, "[LONG] ", name, name_len);
+    output_str(out, " = ");
+    output_int(out, value.long_value);
+    break;
+  case FLOAT:
+    print_label(p, frame, "[FLOAT] ", name, name_len);
+    output_str(out, " = ");
+    output_fixed(out, value.float_value, 2);
+    break;
+  default:
+    print_label(p, frame, "[DOUBLE] ", name, name_len);
+    output_str(out, " = ");
+    output_fixed(out, value.double_value, 4);
+    break;
+  }
+  output_char(out, '\n');
+  return 0;
+}
+
+static int print_string(void *ctx, const char *name, uint16_t name_len,
+                        const char *value, uint16_t value_len) {
+  NBT_Printer *p = ctx;
+  PrintFrame *frame = current_frame(p);
+  if (frame->in_list) {
+    print_element(p, frame);
+  } else {
+    print_label(p, frame, "[STRING] ", name, name_len);
+    output_str(p->out, " = ");
+  }
+  output_write(p->out, value, value_len);
+  output_char(p->out, '\n');
+  return 0;
+}
+
+static int print_array_begin(void *ctx, const char *name, uint16_t name_len,
+                             enum TagType type, int32_t length) {
+  NBT_Printer *p = ctx;
+  PrintFrame *frame = current_frame(p);
+  if (frame->in_list) {
+    print_element(p, frame);
+    output_str(p->out, type == BYTE_ARRAY  ? "byte["
+                       : type == INT_ARRAY ? "int["
+                                           : "long[");
+    output_int(p->out, length);
+    output_str(p->out, "]\n");
+  } else {
+    print_label(p, frame,
+                type == BYTE_ARRAY  ? "[BYTE_ARRAY] "
+                : type == INT_ARRAY ? "[INT_ARRAY] "
+                                    : "[LONG_ARRAY] ",
+                name, name_len);
+    output_str(p->out, ": length=");
+    output_int(p->out, length);
+    output_char(p->out, '\n');
+  }
+  return 0;
+}
+
+static int print_list_begin(void *ctx, const char *name, uint16_t name_len,
+                            enum TagType element_type, int32_t length) {
+  (void)element_type;
+  NBT_Printer *p = ctx;
+  PrintFrame *frame = current_frame(p);
+  if (frame->in_list) {
+    print_element(p, frame);
+    output_str(p->out, "list[");
+    output_int(p->out, length);
+    output_str(p->out, "]\n");
+    push_frame(p, frame->depth + 1, 1, 0);
+  } else {
+    print_label(p, frame, "[LIST] ", name, name_len);
+    output_str(p->out, ": length=");
+    output_int(p->out, length);
+    output_char(p->out, '\n');
+    push_frame(p, frame->depth, 1, 0);
+  }
+  return 0;
+}
+
+static int print_list_end(void *ctx) {
+  NBT_Printer *p = ctx;
+  p->top--;
+  return 0;
+}
+
+const NBT_Handler print_handler = {
+    .begin_compound = print_begin_compound,
+    .end_compound = print_end_compound,
+    .scalar = print_scalar,
+    .string = print_string,
+    .array_begin = print_array_begin,
+    .list_begin = print_list_begin,
+    .list_end = print_list_end,
+};
+
+void init_printer(NBT_Printer *p, NBT_Output *out) {
+  p->out = out;
+  p->top = 0;
+  p->frames[0].depth = 0;
+  p->frames[0].in_list = 0;
+  p->frames[0].print_end = 0;
+  p->frames[0].index = 0;
+}
+
+static const NBT_Handler silent_handler = {0};
+
+int print_buffer_to(NBT_Output *out, uint8_t *buffer, long size) {
+  if (!print_tags) {
+    return nbt_walk(buffer, size, &silent_handler, NULL);
+  }
+  NBT_Printer printer;
+  init_printer(&printer, out);
+  return nbt_walk(buffer, size, &print_handler, &printer);
+}
+
+int print_buffer(uint8_t *buffer, long size) {
+  NBT_Output out;
+  // messages already printed through stdio go out first
+  fflush(stdout);
+  if (output_init_fd(&out, STDOUT_FILENO, 0) != 0) {
+    return NBT_WALK_ERROR;
+  }
+  int result = print_buffer_to(&out, buffer, size);
+  output_release(&out);
+  return result;
+}
+
+int print_stream(NBT_ReadFn read, void *source, long window) {
+  if (!print_tags) {
+    return nbt_walk_stream(read, source, window, &silent_handler, NULL);
+  }
+  NBT_Output out;
+  fflush(stdout);
+  if (output_init_fd(&out, STDOUT_FILENO, 0) != 0) {
+    return NBT_WALK_ERROR;
+  }
+  NBT_Printer printer;
+  init_printer(&printer, &out);
+  int result =
+      nbt_walk_stream(read, source, window, &print_handler, &printer);
+  output_release(&out);
+  return result;
+}
@@ -0,0 +1,35 @@
+#ifndef NBT_PRINTER_H
+#define NBT_PRINTER_H
+
+#include "events.h"
+#include "output.h"
+
+extern int print_tags;
+
+// One frame per open compound or list. Named tags of a compound are indented
+// by its depth, list elements are printed as "[i] = value" one step further
+// in than the list itself.
+typedef struct PrintFrame {
+  int depth;
+  int in_list;
+  int print_end;
+  int32_t index;
+} PrintFrame;
+
+typedef struct NBT_Printer {
+  NBT_Output *out;
+  PrintFrame frames[NBT_MAX_DEPTH + 2];
+  int top;
+} NBT_Printer;
+
+// Handler behind print_buffer, for callers that drive or filter the events
+// themselves
+extern const NBT_Handler print_handler;
+void init_printer(NBT_Printer *p, NBT_Output *out);
+
+// Prints every tag of the buffer in the viewer's indented text format
+int print_buffer(uint8_t *buffer, long size);
+int print_buffer_to(NBT_Output *out, uint8_t *buffer, long size);
+int print_stream(NBT_ReadFn read, void *source, long window);
+
+#endif // NBT_PRINTER_H
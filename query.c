@@ -0,0 +1,512 @@
+#include "query.h"
+#include "index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static NBT_Query *query_error(NBT_Query *query, size_t pos,
+                              const char *message) {
+  printf("Invalid query \"%s\" at position %zu: %s\n", query->text, pos,
+         message);
+  free_query(query);
+  return NULL;
+}
+
+NBT_Query *compile_query(const char *text) {
+  NBT_Query *query = calloc(1, sizeof(NBT_Query));
+  if (query == NULL || (query->text = strdup(text)) == NULL) {
+    printf("Could not allocate memory for query\n");
+    free(query);
+    return NULL;
+  }
+
+  const char *s = query->text;
+  size_t pos = 0;
+  while (s[pos] != '\0') {
+    int descend = 0;
+    if (s[pos] == '.' && s[pos + 1] == '.') {
+      descend = 1;
+      pos += 2;
+    } else if (s[pos] == '.') {
+      if (query->count == 0) {
+        return query_error(query, pos, "expected a key");
+      }
+      pos++;
+      if (s[pos] == '[') {
+        return query_error(query, pos, "expected a key");
+      }
+    } else if (query->count > 0 && s[pos] != '[') {
+      return query_error(query, pos, "expected '.' or '['");
+    }
+
+    if (query->count == NBT_QUERY_MAX_STEPS) {
+      return query_error(query, pos, "too many steps");
+    }
+    QueryStep *step = &query->steps[query->count++];
+    step->descend = descend;
+
+    if (s[pos] == '[') {
+      pos++;
+      if (s[pos] == '*') {
+        step->kind = QUERY_ANY_INDEX;
+        pos++;
+      } else {
+        char *end;
+        long index = strtol(s + pos, &end, 10);
+        if (end == s + pos || index < 0 || index > INT32_MAX) {
+          return query_error(query, pos, "expected a list index or '*'");
+        }
+        step->kind = QUERY_INDEX;
+        step->index = index;
+        pos = end - s;
+      }
+      if (s[pos] != ']') {
+        return query_error(query, pos, "expected ']'");
+      }
+      pos++;
+    } else if (s[pos] == '*') {
+      step->kind = QUERY_ANY_KEY;
+      pos++;
+    } else if (s[pos] == '"') {
+      const char *end = strchr(s + pos + 1, '"');
+      if (end == NULL) {
+        return query_error(query, pos, "unterminated quote");
+      }
+      step->kind = QUERY_KEY;
+      step->name = s + pos + 1;
+      step->name_len = end - step->name;
+      pos = end + 1 - s;
+    } else {
+      size_t len = strcspn(s + pos, ".[]\"");
+      if (len == 0 || len > UINT16_MAX) {
+        return query_error(query, pos, "expected a key");
+      }
+      step->kind = QUERY_KEY;
+      step->name = s + pos;
+      step->name_len = len;
+      pos += len;
+    }
+  }
+  return query;
+}
+
+void free_query(NBT_Query *query) {
+  if (query == NULL) {
+    return;
+  }
+  free(query->text);
+  free(query);
+}
+
+// key is the interned name of a key step, NULL if names are not interned
+static int step_matches(const QueryStep *step, const char *key,
+                        const char *name, uint16_t name_len, int32_t index) {
+  switch (step->kind) {
+  case QUERY_KEY:
+    if (key != NULL) {
+      return index < 0 && name == key;
+    }
+    return index < 0 && step->name_len == name_len &&
+           memcmp(step->name, name, name_len) == 0;
+  case QUERY_ANY_KEY:
+    return index < 0;
+  case QUERY_INDEX:
+    return index == step->index;
+  default:
+    return index >= 0;
+  }
+}
+
+// States of a child from those of its container. index is -1 for children
+// of a compound. Key steps that matched are added to consumed, compound
+// names are unique so they cannot match again in the same compound. keys
+// holds the interned names of the steps when the names of the tree are
+// interned, NULL otherwise.
+static uint64_t query_advance(const NBT_Query *query, const char *const *keys,
+                              uint64_t states, const char *name,
+                              uint16_t name_len, int32_t index,
+                              uint64_t *consumed) {
+  uint64_t next = 0;
+  for (int p = 0; p < query->count; p++) {
+    if (!(states & (1ull << p))) {
+      continue;
+    }
+    const QueryStep *step = &query->steps[p];
+    if (step->descend) {
+      next |= 1ull << p;
+    }
+    if (step_matches(step, keys ? keys[p] : NULL, name, name_len, index)) {
+      next |= 1ull << (p + 1);
+      if (step->kind == QUERY_KEY && !step->descend) {
+        *consumed |= 1ull << p;
+      }
+    }
+  }
+  return next;
+}
+
+// Tree matching
+
+typedef struct TreeQuery {
+  const NBT_Query *query;
+  NBT_Document *doc;
+  NBT_QueryFn fn;
+  void *ctx;
+  long matches;
+  int stopped;
+  // interned key names, when the document interns its names
+  const char *const *keys;
+} TreeQuery;
+
+// stands in for a key that no tag of the document is called, the table
+// never hands out this address
+static const char unknown_key[1];
+
+static void match_children(TreeQuery *t, NBT_Tag *tag, uint64_t states);
+
+static void match_tag(TreeQuery *t, NBT_Tag *tag, uint64_t states) {
+  if (states & (1ull << t->query->count)) {
+    t->matches++;
+    t->stopped = t->fn(t->ctx, tag) != 0;
+  } else if (states != 0) {
+    match_children(t, tag, states);
+  }
+}
+
+static void match_children(TreeQuery *t, NBT_Tag *tag, uint64_t states) {
+  uint64_t consumed = 0;
+  if (tag->tag_type == COMPOUND) {
+    // a single exact key is one index lookup instead of a scan
+    if ((states & (states - 1)) == 0) {
+      int p = __builtin_ctzll(states);
+      const QueryStep *step = &t->query->steps[p];
+      if (step->kind == QUERY_KEY && !step->descend) {
+        NBT_Tag *child =
+            compound_get(t->doc, tag, step->name, step->name_len);
+        if (child != NULL) {
+          match_tag(t, child, 1ull << (p + 1));
+        }
+        return;
+      }
+    }
+    int32_t length;
+    NBT_Tag *elements = tag_elements(t->doc, tag, &length);
+    for (int32_t i = 0; i < length && !t->stopped; i++) {
+      NBT_Tag *child = &elements[i];
+      match_tag(t, child,
+                query_advance(t->query, t->keys, states, child->name,
+                              child->name_length, -1, &consumed));
+    }
+  } else if (tag->tag_type == LIST &&
+             number_size(tag->value.list_value.element_type) != 0) {
+    // numbers of a packed list have no tag of their own, a matching one is
+    // handed out in a temporary
+    for (int32_t i = 0; i < tag->value.list_value.length && !t->stopped;
+         i++) {
+      uint64_t next =
+          query_advance(t->query, t->keys, states, NULL, 0, i, &consumed);
+      if (next & (1ull << t->query->count)) {
+        NBT_Tag element = {tag->value.list_value.element_type, 0, 0, NULL,
+                           list_number(tag, i)};
+        match_tag(t, &element, next);
+      }
+    }
+  } else if (tag->tag_type == LIST) {
+    int32_t length;
+    NBT_Tag *elements = tag_elements(t->doc, tag, &length);
+    for (int32_t i = 0; i < length && !t->stopped; i++) {
+      match_tag(t, &elements[i],
+                query_advance(t->query, t->keys, states, NULL, 0, i,
+                              &consumed));
+    }
+  }
+}
+
+long query_tree(const NBT_Query *query, NBT_Document *doc, NBT_QueryFn fn,
+                void *ctx) {
+  const char *keys[NBT_QUERY_MAX_STEPS];
+  TreeQuery t = {query, doc, fn, ctx, 0, 0, NULL};
+  if (doc->names != NULL) {
+    for (int p = 0; p < query->count; p++) {
+      const QueryStep *step = &query->steps[p];
+      keys[p] = NULL;
+      if (step->kind == QUERY_KEY) {
+        keys[p] = find_name(doc->names, step->name, step->name_len);
+        if (keys[p] == NULL) {
+          keys[p] = unknown_key;
+        }
+      }
+    }
+    t.keys = keys;
+  }
+  if (doc->root != NULL) {
+    match_tag(&t, doc->root, 1);
+  }
+  return t.matches;
+}
+
+// Flat tree matching, one forward scan over the node array. A subtree that
+// cannot match is jumped over through the next sibling of its root.
+
+long query_flat(const NBT_Query *query, const NBT_FlatTree *tree,
+                NBT_FlatQueryFn fn, void *ctx) {
+  struct {
+    // index after the last node of the container
+    uint32_t end;
+    uint64_t states;
+    int32_t next_index;
+  } frames[NBT_MAX_DEPTH + 2];
+  int top = 0;
+  frames[0].end = tree->count;
+  long matches = 0;
+
+  uint32_t i = 0;
+  while (i < tree->count) {
+    while (top > 0 && i >= frames[top].end) {
+      top--;
+    }
+    const NBT_FlatNode *node = &tree->nodes[i];
+    uint32_t end = node->next != NBT_FLAT_NONE ? node->next : frames[top].end;
+
+    uint64_t states = 1;
+    if (top > 0) {
+      uint64_t consumed = 0;
+      if (tree->nodes[node->parent].type == LIST) {
+        states = query_advance(query, NULL, frames[top].states, NULL, 0,
+                               frames[top].next_index++, &consumed);
+      } else {
+        states = query_advance(query, NULL, frames[top].states,
+                               flat_name(tree, node), node->name_length, -1,
+                               &consumed);
+      }
+      frames[top].states &= ~consumed;
+    }
+
+    if (states & (1ull << query->count)) {
+      matches++;
+      if (fn(ctx, tree, i) != 0) {
+        break;
+      }
+    } else if (states != 0 && (node->type == COMPOUND || node->type == LIST)) {
+      top++;
+      frames[top].end = end;
+      frames[top].states = states;
+      frames[top].next_index = 0;
+      i++;
+      continue;
+    }
+    // nothing left to find among the siblings
+    i = (top > 0 && frames[top].states == 0) ? frames[top].end : end;
+  }
+  return matches;
+}
+
+// Event matching
+
+void init_query_matcher(NBT_QueryMatcher *m, const NBT_Query *query,
+                        const NBT_Handler *target, void *target_ctx) {
+  m->query = query;
+  m->target = target;
+  m->target_ctx = target_ctx;
+  m->top = 0;
+  m->forwarding = 0;
+  m->forward_array = 0;
+  m->matches = 0;
+}
+
+// no open container can lead to another match
+static int query_finished(NBT_QueryMatcher *m) {
+  for (int i = 1; i <= m->top; i++) {
+    if (m->frames[i].states != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// States of the tag that starts now. Names list elements after their index.
+static uint64_t query_child(NBT_QueryMatcher *m, const char **name,
+                            uint16_t *name_len) {
+  m->forward_array = 0;
+  if (m->top == 0) {
+    return 1;
+  }
+  QueryFrame *parent = &m->frames[m->top];
+  uint64_t consumed = 0;
+  uint64_t next;
+  if (parent->in_list) {
+    int32_t index = parent->next_index++;
+    next = query_advance(m->query, NULL, parent->states, NULL, 0, index,
+                         &consumed);
+    *name_len = snprintf(m->element_name, sizeof(m->element_name), "[%d]",
+                         index);
+    *name = m->element_name;
+  } else {
+    next = query_advance(m->query, NULL, parent->states, *name, *name_len, -1,
+                         &consumed);
+  }
+  parent->states &= ~consumed;
+  return next;
+}
+
+static int query_matched(NBT_QueryMatcher *m, uint64_t states) {
+  if (states & (1ull << m->query->count)) {
+    m->matches++;
+    return 1;
+  }
+  return 0;
+}
+
+static int query_enter(NBT_QueryMatcher *m, uint64_t states, int in_list) {
+  if (states == 0) {
+    return query_finished(m) ? NBT_STOP : NBT_SKIP;
+  }
+  QueryFrame *frame = &m->frames[++m->top];
+  frame->states = states;
+  frame->in_list = in_list;
+  frame->next_index = 0;
+  return NBT_CONTINUE;
+}
+
+// Counts the container the target was handed, unless the target skips it
+static int query_forward(NBT_QueryMatcher *m, int result) {
+  if (result == NBT_CONTINUE) {
+    m->forwarding++;
+  } else if (result == NBT_SKIP && m->forwarding == 0 && query_finished(m)) {
+    return NBT_STOP;
+  }
+  return result;
+}
+
+static int query_begin_compound(void *ctx, const char *name,
+                                uint16_t name_len) {
+  NBT_QueryMatcher *m = ctx;
+  const NBT_Handler *t = m->target;
+  if (m->forwarding == 0) {
+    uint64_t states = query_child(m, &name, &name_len);
+    if (!query_matched(m, states)) {
+      return query_enter(m, states, 0);
+    }
+  }
+  return query_forward(m, t->begin_compound
+                              ? t->begin_compound(m->target_ctx, name,
+                                                  name_len)
+                              : NBT_CONTINUE);
+}
+
+static int query_list_begin(void *ctx, const char *name, uint16_t name_len,
+                            enum TagType element_type, int32_t length) {
+  NBT_QueryMatcher *m = ctx;
+  const NBT_Handler *t = m->target;
+  if (m->forwarding == 0) {
+    uint64_t states = query_child(m, &name, &name_len);
+    if (!query_matched(m, states)) {
+      return query_enter(m, states, 1);
+    }
+  }
+  return query_forward(m, t->list_begin
+                              ? t->list_begin(m->target_ctx, name, name_len,
+                                              element_type, length)
+                              : NBT_CONTINUE);
+}
+
+// end_compound and list_end
+static int query_end(NBT_QueryMatcher *m, int (*end)(void *ctx)) {
+  if (m->forwarding > 0) {
+    int result = end ? end(m->target_ctx) : NBT_CONTINUE;
+    if (--m->forwarding == 0 && result == NBT_CONTINUE && query_finished(m)) {
+      return NBT_STOP;
+    }
+    return result;
+  }
+  m->forward_array = 0;
+  m->top--;
+  return query_finished(m) ? NBT_STOP : NBT_CONTINUE;
+}
+
+static int query_end_compound(void *ctx) {
+  NBT_QueryMatcher *m = ctx;
+  return query_end(m, m->target->end_compound);
+}
+
+static int query_list_end(void *ctx) {
+  NBT_QueryMatcher *m = ctx;
+  return query_end(m, m->target->list_end);
+}
+
+static int query_scalar(void *ctx, const char *name, uint16_t name_len,
+                        enum TagType type, union NBT_Value value) {
+  NBT_QueryMatcher *m = ctx;
+  const NBT_Handler *t = m->target;
+  if (m->forwarding > 0) {
+    return t->scalar ? t->scalar(m->target_ctx, name, name_len, type, value)
+                     : NBT_CONTINUE;
+  }
+  uint64_t states = query_child(m, &name, &name_len);
+  if (query_matched(m, states) && t->scalar) {
+    int result = t->scalar(m->target_ctx, name, name_len, type, value);
+    if (result != NBT_CONTINUE) {
+      return result;
+    }
+  }
+  return query_finished(m) ? NBT_STOP : NBT_CONTINUE;
+}
+
+static int query_string(void *ctx, const char *name, uint16_t name_len,
+                        const char *value, uint16_t value_len) {
+  NBT_QueryMatcher *m = ctx;
+  const NBT_Handler *t = m->target;
+  if (m->forwarding > 0) {
+    return t->string
+               ? t->string(m->target_ctx, name, name_len, value, value_len)
+               : NBT_CONTINUE;
+  }
+  uint64_t states = query_child(m, &name, &name_len);
+  if (query_matched(m, states) && t->string) {
+    int result = t->string(m->target_ctx, name, name_len, value, value_len);
+    if (result != NBT_CONTINUE) {
+      return result;
+    }
+  }
+  return query_finished(m) ? NBT_STOP : NBT_CONTINUE;
+}
+
+static int query_array_begin(void *ctx, const char *name, uint16_t name_len,
+                             enum TagType type, int32_t length) {
+  NBT_QueryMatcher *m = ctx;
+  const NBT_Handler *t = m->target;
+  if (m->forwarding > 0) {
+    return t->array_begin
+               ? t->array_begin(m->target_ctx, name, name_len, type, length)
+               : NBT_CONTINUE;
+  }
+  uint64_t states = query_child(m, &name, &name_len);
+  if (query_matched(m, states)) {
+    // the walk stops at the next tag if this was the last possible match
+    m->forward_array = 1;
+    return t->array_begin
+               ? t->array_begin(m->target_ctx, name, name_len, type, length)
+               : NBT_CONTINUE;
+  }
+  return query_finished(m) ? NBT_STOP : NBT_SKIP;
+}
+
+static int query_array_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  NBT_QueryMatcher *m = ctx;
+  const NBT_Handler *t = m->target;
+  if ((m->forwarding > 0 || m->forward_array) && t->array_chunk) {
+    return t->array_chunk(m->target_ctx, data, count);
+  }
+  return NBT_CONTINUE;
+}
+
+const NBT_Handler query_handler = {
+    .begin_compound = query_begin_compound,
+    .end_compound = query_end_compound,
+    .scalar = query_scalar,
+    .string = query_string,
+    .array_begin = query_array_begin,
+    .array_chunk = query_array_chunk,
+    .list_begin = query_list_begin,
+    .list_end = query_list_end,
+};
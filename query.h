@@ -0,0 +1,92 @@
+#ifndef NBT_QUERY_H
+#define NBT_QUERY_H
+
+#include "events.h"
+#include "flat.h"
+#include "parser.h"
+#include <stdint.h>
+
+// Path expressions, evaluated below the root compound:
+//   Data.Player.Health    keys of nested compounds
+//   Inventory[3].id       element 3 of a list
+//   Inventory[*].id       every element of a list
+//   Data.*                every child of a compound
+//   ..id                  id at any depth, also Data..id
+//   "key.with dots"       quoted keys
+// A query is compiled once and then run against any number of trees or
+// event streams.
+
+#define NBT_QUERY_MAX_STEPS 63
+
+enum QueryStepKind {
+  QUERY_KEY,
+  QUERY_ANY_KEY,
+  QUERY_INDEX,
+  QUERY_ANY_INDEX,
+};
+
+typedef struct QueryStep {
+  enum QueryStepKind kind;
+  // matches at any depth below the previous step, not only directly below
+  int descend;
+  const char *name;
+  uint16_t name_len;
+  int32_t index;
+} QueryStep;
+
+typedef struct NBT_Query {
+  int count;
+  // copy of the expression, key names point into it
+  char *text;
+  QueryStep steps[NBT_QUERY_MAX_STEPS];
+} NBT_Query;
+
+NBT_Query *compile_query(const char *text);
+void free_query(NBT_Query *query);
+
+// Calls fn for every tag of the tree the query matches, the subtree of a
+// match is not searched any further. Returning nonzero from fn stops the
+// search. Returns the number of matches. Numbers of packed lists are passed
+// as a tag that is only valid during the call.
+typedef int (*NBT_QueryFn)(void *ctx, NBT_Tag *tag);
+long query_tree(const NBT_Query *query, NBT_Document *doc, NBT_QueryFn fn,
+                void *ctx);
+
+// Same for a flat tree, fn gets the index of the matching node
+typedef int (*NBT_FlatQueryFn)(void *ctx, const NBT_FlatTree *tree,
+                               uint32_t node);
+long query_flat(const NBT_Query *query, const NBT_FlatTree *tree,
+                NBT_FlatQueryFn fn, void *ctx);
+
+// Position in the tree for every open compound or list: the query steps
+// that can still match below it, as bits
+typedef struct QueryFrame {
+  uint64_t states;
+  int in_list;
+  int32_t next_index;
+} QueryFrame;
+
+// Event filter: walked with query_handler, it hands every matching tag and
+// its whole subtree to the target handler as if it were a root tag. List
+// elements are named after their index, "[3]". Subtrees that cannot
+// contain a match are skipped, and the walk stops once no further match is
+// possible.
+typedef struct NBT_QueryMatcher {
+  const NBT_Query *query;
+  const NBT_Handler *target;
+  void *target_ctx;
+  QueryFrame frames[NBT_MAX_DEPTH + 2];
+  int top;
+  // nesting depth inside the match being forwarded, 0 outside of matches
+  int forwarding;
+  // an array matched, its chunks go to the target
+  int forward_array;
+  long matches;
+  char element_name[16];
+} NBT_QueryMatcher;
+
+extern const NBT_Handler query_handler;
+void init_query_matcher(NBT_QueryMatcher *m, const NBT_Query *query,
+                        const NBT_Handler *target, void *target_ctx);
+
+#endif // NBT_QUERY_H
@@ -0,0 +1,369 @@
+#include "region.h"
+#include "cursor.h"
+#include "file.h"
+#include "ordered.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline int chunk_index(int x, int z) {
+  return (x & 31) + (z & 31) * 32;
+}
+
+NBT_Region *open_region(const char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("Could not open region file: %s\n", filename);
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 2 * REGION_SECTOR_SIZE) {
+    printf("Region file %s is too small to hold a header\n", filename);
+    close(fd);
+    return NULL;
+  }
+
+  uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps the file referenced
+  close(fd);
+  if (data == MAP_FAILED) {
+    printf("Could not map region file: %s\n", filename);
+    return NULL;
+  }
+  // chunks are looked up one by one, read-ahead of the whole file would only
+  // waste I/O
+  madvise(data, st.st_size, MADV_RANDOM);
+
+  NBT_Region *region = malloc(sizeof(NBT_Region));
+  if (region == NULL) {
+    printf("Could not allocate memory for region\n");
+    munmap(data, st.st_size);
+    return NULL;
+  }
+  region->data = data;
+  region->size = st.st_size;
+
+  for (int i = 0; i < REGION_CHUNKS; i++) {
+    region->locations[i] = load_be32(data + i * 4);
+    region->timestamps[i] = load_be32(data + REGION_SECTOR_SIZE + i * 4);
+  }
+  return region;
+}
+
+void close_region(NBT_Region *region) {
+  if (region == NULL) {
+    return;
+  }
+  munmap(region->data, region->size);
+  free(region);
+}
+
+int region_has_chunk(const NBT_Region *region, int x, int z) {
+  return region->locations[chunk_index(x, z)] != 0;
+}
+
+uint32_t region_chunk_timestamp(const NBT_Region *region, int x, int z) {
+  return region->timestamps[chunk_index(x, z)];
+}
+
+// Decompresses the NBT of one chunk into a new heap buffer. Returns its size,
+// 0 if the chunk does not exist and -1 on errors.
+long region_read_chunk(const NBT_Region *region, int x, int z,
+                       uint8_t **out_buffer) {
+  uint32_t location = region->locations[chunk_index(x, z)];
+  if (location == 0) {
+    return 0;
+  }
+
+  size_t offset = (size_t)(location >> 8) * REGION_SECTOR_SIZE;
+  if (offset + 5 > region->size) {
+    printf("Chunk %d,%d points past the end of the region file\n", x, z);
+    return -1;
+  }
+
+  const uint8_t *chunk = region->data + offset;
+  // the length counts the compression byte too
+  uint32_t length = load_be32(chunk);
+  uint8_t compression = chunk[4];
+  if (length < 1 || offset + 4 + length > region->size) {
+    printf("Chunk %d,%d has an invalid length of %u\n", x, z, length);
+    return -1;
+  }
+  const uint8_t *payload = chunk + 5;
+  long payload_len = length - 1;
+
+  switch (compression) {
+  case REGION_GZIP:
+    return decompress_buffer(payload, payload_len, 15 + 16, out_buffer);
+
+  case REGION_ZLIB:
+    return decompress_buffer(payload, payload_len, 15, out_buffer);
+
+  case REGION_UNCOMPRESSED: {
+    uint8_t *buffer = malloc(payload_len ? payload_len : 1);
+    if (buffer == NULL) {
+      printf("Could not allocate memory for chunk %d,%d\n", x, z);
+      return -1;
+    }
+    memcpy(buffer, payload, payload_len);
+    *out_buffer = buffer;
+    return payload_len;
+  }
+
+  default:
+    // 0x80 marks chunks stored in a separate .mcc file
+    printf("Chunk %d,%d uses unsupported compression %d\n", x, z,
+           compression);
+    return -1;
+  }
+}
+
+NBT_Document *region_parse_chunk(const NBT_Region *region, int x, int z,
+                                 int flags) {
+  uint8_t *buffer;
+  long size = region_read_chunk(region, x, z, &buffer);
+  if (size <= 0) {
+    return NULL;
+  }
+
+  NBT_Document *doc = parse(buffer, size, flags);
+  // a zero-copy or lazy document owns the buffer, unless parsing failed
+  if (doc == NULL || !(flags & NBT_PARSE_OWNS_BUFFER)) {
+    free(buffer);
+  }
+  return doc;
+}
+
+typedef struct RegionScan {
+  const NBT_Region *region;
+  int flags;
+  RegionChunkFn fn;
+  void *ctx;
+  // one reused document per worker, so parsing a chunk usually does not
+  // allocate at all once the arena has grown to fit
+  NBT_Document **docs;
+  // chunks of a region share nearly all their names
+  NBT_NameTable *names;
+  NBT_OrderedOutput output;
+  pthread_mutex_t lock;
+  int failed;
+} RegionScan;
+
+static void emit_result(RegionScan *scan, int index, char *text, size_t len,
+                        int failed) {
+  if (failed) {
+    pthread_mutex_lock(&scan->lock);
+    scan->failed++;
+    pthread_mutex_unlock(&scan->lock);
+  }
+  ordered_emit(&scan->output, index, text, len);
+}
+
+static void scan_chunk(void *ctx, int worker, long task) {
+  RegionScan *scan = ctx;
+  RegionChunk chunk;
+  chunk.x = task % 32;
+  chunk.z = task / 32;
+  chunk.worker = worker;
+  chunk.doc = NULL;
+
+  if (!region_has_chunk(scan->region, chunk.x, chunk.z)) {
+    emit_result(scan, task, NULL, 0, 0);
+    return;
+  }
+  chunk.size = region_read_chunk(scan->region, chunk.x, chunk.z, &chunk.data);
+  if (chunk.size <= 0) {
+    emit_result(scan, task, NULL, 0, 1);
+    return;
+  }
+
+  int owned = 0;
+  if (scan->flags & REGION_SCAN_TREE) {
+    NBT_Document *doc = scan->docs[worker];
+    if (doc == NULL) {
+      doc = scan->docs[worker] = create_document(0);
+      if (doc != NULL && (scan->flags & REGION_SCAN_INTERN)) {
+        doc->names = &scan->names[worker];
+      }
+    }
+    if (doc == NULL || parse_into(doc, chunk.data, chunk.size,
+                                  scan->flags & ~REGION_SCAN_FLAGS) != 0) {
+      free(chunk.data);
+      emit_result(scan, task, NULL, 0, 1);
+      return;
+    }
+    chunk.doc = doc;
+    // a zero-copy or lazy document keeps the buffer until it is reused
+    owned = scan->flags & NBT_PARSE_OWNS_BUFFER;
+  }
+
+  NBT_Output out;
+  if (output_init_memory(&out, 0) != 0) {
+    if (!owned) {
+      free(chunk.data);
+    }
+    emit_result(scan, task, NULL, 0, 1);
+    return;
+  }
+  chunk.out = &out;
+  scan->fn(scan->ctx, &chunk);
+
+  if (!owned) {
+    free(chunk.data);
+  }
+  size_t len;
+  char *text = output_take(&out, &len);
+  emit_result(scan, task, text, len, out.failed);
+}
+
+// Decompresses every chunk of the region on the pool and calls fn for each
+// of them. Output written to chunk->out is copied to out in chunk order no
+// matter which worker finishes first. Returns the number of chunks that
+// could not be read or parsed, -1 if the scan could not start.
+int region_scan(const NBT_Region *region, NBT_Pool *pool, int flags,
+                RegionChunkFn fn, void *ctx, NBT_Output *out) {
+  RegionScan scan;
+  scan.region = region;
+  scan.flags = flags;
+  scan.fn = fn;
+  scan.ctx = ctx;
+  scan.failed = 0;
+  scan.docs = calloc(pool_size(pool), sizeof(NBT_Document *));
+  scan.names = malloc(pool_size(pool) * sizeof(NBT_NameTable));
+  if (scan.docs == NULL || scan.names == NULL) {
+    printf("Could not allocate memory for region scan\n");
+    free(scan.docs);
+    free(scan.names);
+    return -1;
+  }
+  if (ordered_init(&scan.output, out, REGION_CHUNKS) != 0) {
+    free(scan.docs);
+    free(scan.names);
+    return -1;
+  }
+  for (int i = 0; i < pool_size(pool); i++) {
+    name_table_init(&scan.names[i]);
+  }
+  pthread_mutex_init(&scan.lock, NULL);
+
+  pool_run(pool, REGION_CHUNKS, scan_chunk, &scan);
+
+  for (int i = 0; i < pool_size(pool); i++) {
+    free_document(scan.docs[i]);
+    name_table_free(&scan.names[i]);
+  }
+  pthread_mutex_destroy(&scan.lock);
+  ordered_release(&scan.output);
+  free(scan.docs);
+  free(scan.names);
+  return scan.failed;
+}
+
+// Chunks of region_write, compressed on the pool and laid out afterwards
+typedef struct RegionWrite {
+  const NBT_Region *region;
+  enum RegionCompression compression;
+  uint8_t *data[REGION_CHUNKS];
+  // 0 for chunks that are not present, -1 for chunks that failed
+  long sizes[REGION_CHUNKS];
+} RegionWrite;
+
+static void write_chunk(void *ctx, int worker, long task) {
+  (void)worker;
+  RegionWrite *w = ctx;
+  int x = task % 32, z = task / 32;
+  w->data[task] = NULL;
+  w->sizes[task] = 0;
+  if (!region_has_chunk(w->region, x, z)) {
+    return;
+  }
+  uint8_t *nbt;
+  long size = region_read_chunk(w->region, x, z, &nbt);
+  if (size <= 0) {
+    w->sizes[task] = -1;
+    return;
+  }
+  if (w->compression == REGION_UNCOMPRESSED) {
+    w->data[task] = nbt;
+    w->sizes[task] = size;
+    return;
+  }
+  int window_bits = w->compression == REGION_GZIP ? 15 + 16 : 15;
+  w->sizes[task] = compress_buffer(nbt, size, window_bits,
+                                   Z_DEFAULT_COMPRESSION, &w->data[task]);
+  free(nbt);
+}
+
+// Writes every chunk of region to a new region file, compressed as given.
+// Chunks are inflated and compressed again in parallel on the pool, each on
+// its own, then packed into sectors in chunk order with their timestamps.
+// Returns the number of chunks that were left out, -1 if the file could not
+// be written.
+int region_write(const NBT_Region *region, NBT_Pool *pool,
+                 const char *filename, enum RegionCompression compression) {
+  RegionWrite *w = malloc(sizeof(RegionWrite));
+  if (w == NULL) {
+    printf("Could not allocate memory for region write\n");
+    return -1;
+  }
+  w->region = region;
+  w->compression = compression;
+  pool_run(pool, REGION_CHUNKS, write_chunk, w);
+
+  // the two header sectors come first
+  uint32_t sectors = 2;
+  uint32_t locations[REGION_CHUNKS];
+  int failed = 0;
+  for (int i = 0; i < REGION_CHUNKS; i++) {
+    locations[i] = 0;
+    if (w->sizes[i] <= 0) {
+      failed += w->sizes[i] < 0;
+      continue;
+    }
+    // length, compression byte and payload
+    long count =
+        (w->sizes[i] + 5 + REGION_SECTOR_SIZE - 1) / REGION_SECTOR_SIZE;
+    if (count > 255) {
+      printf("Chunk %d,%d does not fit in 255 sectors\n", i % 32, i / 32);
+      failed++;
+      continue;
+    }
+    locations[i] = sectors << 8 | count;
+    sectors += count;
+  }
+
+  int result = -1;
+  uint8_t *file = calloc(sectors, REGION_SECTOR_SIZE);
+  if (file == NULL) {
+    printf("Could not allocate memory for region file\n");
+  } else {
+    for (int i = 0; i < REGION_CHUNKS; i++) {
+      store_be32(file + i * 4, locations[i]);
+      store_be32(file + REGION_SECTOR_SIZE + i * 4,
+                 locations[i] ? region->timestamps[i] : 0);
+      if (locations[i] != 0) {
+        uint8_t *chunk =
+            file + (size_t)(locations[i] >> 8) * REGION_SECTOR_SIZE;
+        store_be32(chunk, w->sizes[i] + 1);
+        chunk[4] = compression;
+        memcpy(chunk + 5, w->data[i], w->sizes[i]);
+      }
+    }
+    if (write_file(filename, file, (long)sectors * REGION_SECTOR_SIZE) == 0) {
+      result = failed;
+    }
+    free(file);
+  }
+
+  for (int i = 0; i < REGION_CHUNKS; i++) {
+    free(w->data[i]);
+  }
+  free(w);
+  return result;
+}
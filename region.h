@@ -0,0 +1,71 @@
+#ifndef NBT_REGION_H
+#define NBT_REGION_H
+
+#include "output.h"
+#include "parser.h"
+#include "threadpool.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define REGION_CHUNKS 1024
+#define REGION_SECTOR_SIZE 4096
+
+// chunk compression schemes of the Anvil format
+enum RegionCompression {
+  REGION_GZIP = 1,
+  REGION_ZLIB = 2,
+  REGION_UNCOMPRESSED = 3,
+};
+
+// A memory mapped .mca file. Only the header is decoded on open, chunks are
+// read and inflated one at a time on demand.
+typedef struct NBT_Region {
+  uint8_t *data;
+  size_t size;
+  // sector offset << 8 | sector count, 0 for chunks that were never saved
+  uint32_t locations[REGION_CHUNKS];
+  uint32_t timestamps[REGION_CHUNKS];
+} NBT_Region;
+
+NBT_Region *open_region(const char *filename);
+void close_region(NBT_Region *region);
+
+// x and z are chunk coordinates, only their low 5 bits select the chunk
+int region_has_chunk(const NBT_Region *region, int x, int z);
+uint32_t region_chunk_timestamp(const NBT_Region *region, int x, int z);
+long region_read_chunk(const NBT_Region *region, int x, int z,
+                       uint8_t **out_buffer);
+NBT_Document *region_parse_chunk(const NBT_Region *region, int x, int z,
+                                 int flags);
+
+// region_scan flag, combined with the NBT_ParseFlags: parse every chunk
+// into chunk->doc before handing it out
+#define REGION_SCAN_TREE (1 << 8)
+// with REGION_SCAN_TREE: intern the tag names of every chunk a worker parses
+// in one table kept for the whole scan, see names.h
+#define REGION_SCAN_INTERN (1 << 9)
+#define REGION_SCAN_FLAGS (REGION_SCAN_TREE | REGION_SCAN_INTERN)
+
+// One decompressed chunk handed to a region_scan callback. data and doc are
+// only valid until the callback returns, doc is NULL without
+// REGION_SCAN_TREE. Whatever is written to out ends up in the output of the
+// scan, in chunk order.
+typedef struct RegionChunk {
+  int x;
+  int z;
+  int worker;
+  uint8_t *data;
+  long size;
+  NBT_Document *doc;
+  NBT_Output *out;
+} RegionChunk;
+
+typedef void (*RegionChunkFn)(void *ctx, RegionChunk *chunk);
+
+int region_scan(const NBT_Region *region, NBT_Pool *pool, int flags,
+                RegionChunkFn fn, void *ctx, NBT_Output *out);
+
+int region_write(const NBT_Region *region, NBT_Pool *pool,
+                 const char *filename, enum RegionCompression compression);
+
+#endif // NBT_REGION_H
@@ -0,0 +1,1007 @@
+#include "snbt.h"
+#include "cursor.h"
+#include "writer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Characters of keys and strings that can go without quotes
+static int is_bare(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c == '_' || c == '-' || c == '.' ||
+         c == '+';
+}
+
+// Quoted with " unless the text holds a " but no '. Backslashes and the
+// quote are escaped, and so are line breaks and tabs, every root stays on
+// one line.
+static void put_quoted(NBT_Output *out, const char *s, size_t len) {
+  char quote = '"';
+  if (memchr(s, '"', len) != NULL && memchr(s, '\'', len) == NULL) {
+    quote = '\'';
+  }
+  output_char(out, quote);
+  size_t start = 0;
+  for (size_t i = 0; i < len; i++) {
+    char escape;
+    switch (s[i]) {
+    case '\\':
+      escape = '\\';
+      break;
+    case '\n':
+      escape = 'n';
+      break;
+    case '\r':
+      escape = 'r';
+      break;
+    case '\t':
+      escape = 't';
+      break;
+    default:
+      if (s[i] != quote) {
+        continue;
+      }
+      escape = quote;
+      break;
+    }
+    char pair[2] = {'\\', escape};
+    output_write(out, s + start, i - start);
+    output_write(out, pair, 2);
+    start = i + 1;
+  }
+  output_write(out, s + start, len - start);
+  output_char(out, quote);
+}
+
+static void put_key(NBT_Output *out, const char *name, uint16_t name_len) {
+  int bare = name_len > 0;
+  for (uint16_t i = 0; i < name_len && bare; i++) {
+    bare = is_bare(name[i]);
+  }
+  if (bare) {
+    output_write(out, name, name_len);
+  } else {
+    put_quoted(out, name, name_len);
+  }
+}
+
+static void put_real(NBT_Output *out, double value, int single) {
+  if (isnan(value)) {
+    output_write(out, "NaN", 3);
+  } else if (isinf(value)) {
+    output_str(out, value < 0 ? "-Infinity" : "Infinity");
+  } else if (single) {
+    output_float(out, (float)value);
+  } else {
+    output_double(out, value);
+  }
+  output_char(out, single ? 'f' : 'd');
+}
+
+static void put_number(NBT_Output *out, enum TagType type,
+                       union NBT_Value value) {
+  switch (type) {
+  case BYTE:
+    output_int(out, value.byte_value);
+    output_char(out, 'b');
+    break;
+  case SHORT:
+    output_int(out, value.short_value);
+    output_char(out, 's');
+    break;
+  case INT:
+    output_int(out, value.int_value);
+    break;
+  case LONG:
+    output_int(out, value.long_value);
+    output_char(out, 'L');
+    break;
+  case FLOAT:
+    put_real(out, value.float_value, 1);
+    break;
+  default:
+    put_real(out, value.double_value, 0);
+    break;
+  }
+}
+
+// Element of an array or packed list in host order
+static union NBT_Value host_number(enum TagType type, const void *values,
+                                   int32_t i) {
+  union NBT_Value value;
+  memcpy(&value, (const char *)values + (size_t)i * number_size(type),
+         number_size(type));
+  return value;
+}
+
+// Element of an array or list chunk, still big-endian
+static union NBT_Value load_number(enum TagType type, const uint8_t *p) {
+  union NBT_Value value;
+  switch (number_size(type)) {
+  case 1:
+    value.byte_value = (int8_t)p[0];
+    break;
+  case 2:
+    value.short_value = (int16_t)load_be16(p);
+    break;
+  case 4:
+    value.int_value = (int32_t)load_be32(p);
+    break;
+  default:
+    value.long_value = (int64_t)load_be64(p);
+    break;
+  }
+  return value;
+}
+
+static const char *array_prefix(enum TagType type) {
+  return type == BYTE_ARRAY ? "[B;" : type == INT_ARRAY ? "[I;" : "[L;";
+}
+
+static enum TagType array_element(enum TagType type) {
+  return type == BYTE_ARRAY ? BYTE : type == INT_ARRAY ? INT : LONG;
+}
+
+static void put_numbers(NBT_Output *out, enum TagType type, const void *values,
+                        int32_t length) {
+  for (int32_t i = 0; i < length; i++) {
+    if (i > 0) {
+      output_char(out, ',');
+    }
+    put_number(out, type, host_number(type, values, i));
+  }
+  output_char(out, ']');
+}
+
+static int write_value(NBT_Output *out, NBT_Document *doc, NBT_Tag *tag) {
+  union NBT_Value *value = &tag->value;
+  int32_t length;
+  NBT_Tag *elements;
+
+  switch (tag->tag_type) {
+  case BYTE:
+  case SHORT:
+  case INT:
+  case LONG:
+  case FLOAT:
+  case DOUBLE:
+    put_number(out, tag->tag_type, *value);
+    return 0;
+  case STRING:
+    put_quoted(out, value->string_value.data, value->string_value.length);
+    return 0;
+  case BYTE_ARRAY:
+  case INT_ARRAY:
+  case LONG_ARRAY:
+    // the three arrays share their layout
+    output_str(out, array_prefix(tag->tag_type));
+    put_numbers(out, array_element(tag->tag_type), value->byte_array.data,
+                value->byte_array.length);
+    return 0;
+  case LIST:
+    output_char(out, '[');
+    if (number_size(value->list_value.element_type) != 0) {
+      put_numbers(out, value->list_value.element_type,
+                  value->list_value.values, value->list_value.length);
+      return 0;
+    }
+    elements = tag_elements(doc, tag, &length);
+    if (length < 0) {
+      return -1;
+    }
+    for (int32_t i = 0; i < length; i++) {
+      if (i > 0) {
+        output_char(out, ',');
+      }
+      if (write_value(out, doc, &elements[i]) != 0) {
+        return -1;
+      }
+    }
+    output_char(out, ']');
+    return 0;
+  case COMPOUND:
+    elements = tag_elements(doc, tag, &length);
+    if (length < 0) {
+      return -1;
+    }
+    output_char(out, '{');
+    for (int32_t i = 0; i < length; i++) {
+      NBT_Tag *child = &elements[i];
+      if (i > 0) {
+        output_char(out, ',');
+      }
+      put_key(out, child->name, child->name_length);
+      output_char(out, ':');
+      if (write_value(out, doc, child) != 0) {
+        return -1;
+      }
+    }
+    output_char(out, '}');
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+int snbt_write_tag(NBT_Output *out, NBT_Document *doc, NBT_Tag *tag) {
+  if (write_value(out, doc, tag) != 0) {
+    printf("Could not encode malformed tag\n");
+    return -1;
+  }
+  output_char(out, '\n');
+  return out->failed ? -1 : 0;
+}
+
+// Separator and key in front of a value, root values stand alone
+static void snbt_begin(NBT_SnbtWriter *w, const char *name,
+                       uint16_t name_len) {
+  if (w->depth == 0) {
+    return;
+  }
+  if (w->count[w->depth]++ > 0) {
+    output_char(w->out, ',');
+  }
+  if (!w->in_list[w->depth]) {
+    put_key(w->out, name, name_len);
+    output_char(w->out, ':');
+  }
+}
+
+static void snbt_push(NBT_SnbtWriter *w, int in_list) {
+  w->depth++;
+  w->in_list[w->depth] = in_list;
+  w->count[w->depth] = 0;
+}
+
+// Closes the open container, a root ends its line
+static int snbt_pop(NBT_SnbtWriter *w, char close) {
+  output_char(w->out, close);
+  if (--w->depth == 0) {
+    output_char(w->out, '\n');
+  }
+  return w->out->failed;
+}
+
+static int snbt_begin_compound(void *ctx, const char *name,
+                               uint16_t name_len) {
+  NBT_SnbtWriter *w = ctx;
+  snbt_begin(w, name, name_len);
+  output_char(w->out, '{');
+  snbt_push(w, 0);
+  return w->out->failed;
+}
+
+static int snbt_end_compound(void *ctx) { return snbt_pop(ctx, '}'); }
+
+static int snbt_scalar(void *ctx, const char *name, uint16_t name_len,
+                       enum TagType type, union NBT_Value value) {
+  NBT_SnbtWriter *w = ctx;
+  snbt_begin(w, name, name_len);
+  put_number(w->out, type, value);
+  if (w->depth == 0) {
+    output_char(w->out, '\n');
+  }
+  return w->out->failed;
+}
+
+static int snbt_string(void *ctx, const char *name, uint16_t name_len,
+                       const char *value, uint16_t value_len) {
+  NBT_SnbtWriter *w = ctx;
+  snbt_begin(w, name, name_len);
+  put_quoted(w->out, value, value_len);
+  if (w->depth == 0) {
+    output_char(w->out, '\n');
+  }
+  return w->out->failed;
+}
+
+// Arrays take a level of their own while their chunks arrive, so elements
+// are separated like those of a list
+static int snbt_array_begin(void *ctx, const char *name, uint16_t name_len,
+                            enum TagType type, int32_t length) {
+  NBT_SnbtWriter *w = ctx;
+  snbt_begin(w, name, name_len);
+  output_str(w->out, array_prefix(type));
+  snbt_push(w, 1);
+  w->chunk_type = array_element(type);
+  w->array_remaining = length;
+  if (length == 0) {
+    return snbt_pop(w, ']');
+  }
+  return w->out->failed;
+}
+
+static void snbt_put_chunk(NBT_SnbtWriter *w, const uint8_t *data,
+                           int32_t count) {
+  int width = number_size(w->chunk_type);
+  for (int32_t i = 0; i < count; i++) {
+    if (w->count[w->depth]++ > 0) {
+      output_char(w->out, ',');
+    }
+    put_number(w->out, w->chunk_type,
+               load_number(w->chunk_type, data + (size_t)i * width));
+  }
+}
+
+static int snbt_array_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  NBT_SnbtWriter *w = ctx;
+  snbt_put_chunk(w, data, count);
+  w->array_remaining -= count;
+  if (w->array_remaining == 0) {
+    return snbt_pop(w, ']');
+  }
+  return w->out->failed;
+}
+
+static int snbt_list_begin(void *ctx, const char *name, uint16_t name_len,
+                           enum TagType element_type, int32_t length) {
+  NBT_SnbtWriter *w = ctx;
+  (void)length;
+  snbt_begin(w, name, name_len);
+  output_char(w->out, '[');
+  snbt_push(w, 1);
+  w->chunk_type = element_type;
+  return w->out->failed;
+}
+
+static int snbt_list_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  NBT_SnbtWriter *w = ctx;
+  snbt_put_chunk(w, data, count);
+  return w->out->failed;
+}
+
+static int snbt_list_end(void *ctx) { return snbt_pop(ctx, ']'); }
+
+const NBT_Handler snbt_handler = {
+    .begin_compound = snbt_begin_compound,
+    .end_compound = snbt_end_compound,
+    .scalar = snbt_scalar,
+    .string = snbt_string,
+    .array_begin = snbt_array_begin,
+    .array_chunk = snbt_array_chunk,
+    .list_begin = snbt_list_begin,
+    .list_chunk = snbt_list_chunk,
+    .list_end = snbt_list_end,
+};
+
+void init_snbt_writer(NBT_SnbtWriter *w, NBT_Output *out) {
+  w->out = out;
+  w->depth = 0;
+  w->in_list[0] = 0;
+  w->count[0] = 0;
+  w->chunk_type = BYTE;
+  w->array_remaining = 0;
+}
+
+// The text is read twice by the same loop. The first pass checks it and
+// records the length and element type of every list and array in the
+// order they open, which list_begin and array_begin need up front. The
+// second pass feeds the handler.
+
+enum SnbtKind { SNBT_COMPOUND, SNBT_LIST, SNBT_ARRAY };
+
+typedef struct SnbtFrame {
+  uint8_t kind;
+  // element type of a list or array, END while a list is still empty
+  uint8_t element_type;
+  // children or elements read so far
+  int32_t count;
+  // index of the list or array in shapes
+  int32_t shape;
+} SnbtFrame;
+
+typedef struct SnbtShape {
+  int32_t length;
+  uint8_t element_type;
+} SnbtShape;
+
+#define SNBT_LOUD (NBT_MAX_DEPTH + 1)
+#define SNBT_MAX_STRING 65535
+#define SNBT_CHUNK 4096
+
+typedef struct SnbtReader {
+  const char *text;
+  const char *pos;
+  const char *end;
+  // second pass, the handler is called
+  int emit;
+  const NBT_Handler *handler;
+  void *ctx;
+  int depth;
+  SnbtFrame frames[NBT_MAX_DEPTH + 1];
+  // depth of the container the handler skipped, SNBT_LOUD if none
+  int quiet;
+  SnbtShape *shapes;
+  int32_t shape_count;
+  int32_t shape_capacity;
+  int32_t next_shape;
+  // unescaped key and string value, allocated on the first escape
+  char *scratch;
+  // big-endian elements not yet handed to array_chunk or list_chunk
+  uint8_t chunk[SNBT_CHUNK];
+  int32_t chunk_count;
+} SnbtReader;
+
+static int snbt_error(SnbtReader *r, const char *message) {
+  long line = 1;
+  const char *line_start = r->text;
+  for (const char *p = r->text; p < r->pos; p++) {
+    if (*p == '\n') {
+      line++;
+      line_start = p + 1;
+    }
+  }
+  printf("SNBT error at line %ld, column %ld: %s\n", line,
+         (long)(r->pos - line_start) + 1, message);
+  return NBT_WALK_ERROR;
+}
+
+static void skip_space(SnbtReader *r) {
+  while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t' ||
+                             *r->pos == '\n' || *r->pos == '\r')) {
+    r->pos++;
+  }
+}
+
+static int expect(SnbtReader *r, char c) {
+  skip_space(r);
+  return r->pos < r->end && *r->pos == c;
+}
+
+static const char *bare_word(SnbtReader *r, long *len) {
+  const char *start = r->pos;
+  while (r->pos < r->end && is_bare(*r->pos)) {
+    r->pos++;
+  }
+  *len = r->pos - start;
+  return start;
+}
+
+// Quoted string at the cursor. Without escapes it is left in the text,
+// otherwise it is unescaped into scratch slot 0 (keys) or 1 (values).
+static int read_quoted(SnbtReader *r, int slot, const char **s, long *len) {
+  char quote = *r->pos++;
+  const char *start = r->pos;
+  const char *p = start;
+  while (p < r->end && *p != quote && *p != '\\') {
+    p++;
+  }
+  if (p < r->end && *p == quote) {
+    if (p - start > SNBT_MAX_STRING) {
+      return snbt_error(r, "String longer than 65535 bytes");
+    }
+    *s = start;
+    *len = p - start;
+    r->pos = p + 1;
+    return NBT_WALK_DONE;
+  }
+
+  if (r->scratch == NULL) {
+    r->scratch = malloc(2 * (SNBT_MAX_STRING + 1));
+    if (r->scratch == NULL) {
+      printf("Could not allocate memory for SNBT strings\n");
+      return NBT_WALK_ERROR;
+    }
+  }
+  char *dst = r->scratch + slot * (SNBT_MAX_STRING + 1);
+  long n = p - start;
+  if (n > SNBT_MAX_STRING) {
+    return snbt_error(r, "String longer than 65535 bytes");
+  }
+  memcpy(dst, start, n);
+  while (p < r->end && *p != quote) {
+    char c = *p++;
+    if (c == '\\') {
+      if (p == r->end) {
+        break;
+      }
+      switch (*p++) {
+      case '\\':
+        c = '\\';
+        break;
+      case '\'':
+        c = '\'';
+        break;
+      case '"':
+        c = '"';
+        break;
+      case 'n':
+        c = '\n';
+        break;
+      case 'r':
+        c = '\r';
+        break;
+      case 't':
+        c = '\t';
+        break;
+      case 'b':
+        c = '\b';
+        break;
+      case 'f':
+        c = '\f';
+        break;
+      default:
+        r->pos = p - 2;
+        return snbt_error(r, "Unknown escape sequence");
+      }
+    }
+    if (n == SNBT_MAX_STRING) {
+      return snbt_error(r, "String longer than 65535 bytes");
+    }
+    dst[n++] = c;
+  }
+  if (p == r->end) {
+    r->pos = start - 1;
+    return snbt_error(r, "Unterminated string");
+  }
+  *s = dst;
+  *len = n;
+  r->pos = p + 1;
+  return NBT_WALK_DONE;
+}
+
+// Digits of a floating point number: a mantissa with at least one digit and
+// an optional exponent, or NaN and Infinity
+static int is_real(const char *s, long n) {
+  long i = 0;
+  if (i < n && (s[i] == '-' || s[i] == '+')) {
+    i++;
+  }
+  if ((n - i == 3 && memcmp(s + i, "NaN", 3) == 0) ||
+      (n - i == 8 && memcmp(s + i, "Infinity", 8) == 0)) {
+    return 1;
+  }
+  long digits = 0;
+  while (i < n && s[i] >= '0' && s[i] <= '9') {
+    i++;
+    digits++;
+  }
+  if (i < n && s[i] == '.') {
+    i++;
+    while (i < n && s[i] >= '0' && s[i] <= '9') {
+      i++;
+      digits++;
+    }
+  }
+  if (digits == 0) {
+    return 0;
+  }
+  if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+    i++;
+    if (i < n && (s[i] == '-' || s[i] == '+')) {
+      i++;
+    }
+    long exponent = i;
+    while (i < n && s[i] >= '0' && s[i] <= '9') {
+      i++;
+    }
+    if (i == exponent) {
+      return 0;
+    }
+  }
+  return i == n;
+}
+
+// Type and value of a bare word: true and false are bytes, numbers carry an
+// optional suffix, anything else is a string. As in the game, an integer
+// that does not fit its type is a string, and a double without its d
+// suffix needs a '.'.
+static enum TagType classify(const char *s, long n, union NBT_Value *value) {
+  if (n == 4 && memcmp(s, "true", 4) == 0) {
+    value->byte_value = 1;
+    return BYTE;
+  }
+  if (n == 5 && memcmp(s, "false", 5) == 0) {
+    value->byte_value = 0;
+    return BYTE;
+  }
+  char suffix = n > 1 ? s[n - 1] | 0x20 : 0;
+  if (suffix != 'b' && suffix != 's' && suffix != 'l' && suffix != 'f' &&
+      suffix != 'd') {
+    suffix = 0;
+  }
+  long body = suffix != 0 ? n - 1 : n;
+
+  long i = 0;
+  int negative = 0;
+  if (i < body && (s[i] == '-' || s[i] == '+')) {
+    negative = s[i] == '-';
+    i++;
+  }
+  long digits = i;
+  uint64_t magnitude = 0;
+  int overflow = 0;
+  while (i < body && s[i] >= '0' && s[i] <= '9') {
+    if (magnitude > (UINT64_MAX - 9) / 10) {
+      overflow = 1;
+    }
+    magnitude = magnitude * 10 + (s[i] - '0');
+    i++;
+  }
+  if (i > digits && i == body && suffix != 'f' && suffix != 'd') {
+    enum TagType type = suffix == 'b'   ? BYTE
+                        : suffix == 's' ? SHORT
+                        : suffix == 'l' ? LONG
+                                        : INT;
+    uint64_t max = type == BYTE    ? INT8_MAX
+                   : type == SHORT ? INT16_MAX
+                   : type == INT   ? INT32_MAX
+                                   : INT64_MAX;
+    if (overflow || magnitude > max + negative) {
+      return STRING;
+    }
+    int64_t v = negative && magnitude > 0 ? -(int64_t)(magnitude - 1) - 1
+                                          : (int64_t)magnitude;
+    switch (type) {
+    case BYTE:
+      value->byte_value = (int8_t)v;
+      break;
+    case SHORT:
+      value->short_value = (int16_t)v;
+      break;
+    case INT:
+      value->int_value = (int32_t)v;
+      break;
+    default:
+      value->long_value = v;
+      break;
+    }
+    return type;
+  }
+
+  if (suffix == 0 ? memchr(s, '.', body) == NULL
+                  : suffix != 'f' && suffix != 'd') {
+    return STRING;
+  }
+  char digits_copy[64];
+  if (body >= (long)sizeof(digits_copy) || !is_real(s, body)) {
+    return STRING;
+  }
+  memcpy(digits_copy, s, body);
+  digits_copy[body] = '\0';
+  if (suffix == 'f') {
+    value->float_value = strtof(digits_copy, NULL);
+    return FLOAT;
+  }
+  value->double_value = strtod(digits_copy, NULL);
+  return DOUBLE;
+}
+
+static int loud(SnbtReader *r) { return r->emit && r->depth < r->quiet; }
+
+static int flush_chunk(SnbtReader *r) {
+  SnbtFrame *f = &r->frames[r->depth];
+  int (*chunk)(void *, const uint8_t *, int32_t) =
+      f->kind == SNBT_ARRAY ? r->handler->array_chunk : r->handler->list_chunk;
+  int32_t count = r->chunk_count;
+  r->chunk_count = 0;
+  if (chunk != NULL && count > 0 && chunk(r->ctx, r->chunk, count) != 0) {
+    return NBT_WALK_STOPPED;
+  }
+  return NBT_WALK_DONE;
+}
+
+// Queues an element of the open array or packed list as big-endian
+static int chunk_number(SnbtReader *r, enum TagType type,
+                        union NBT_Value value) {
+  int width = number_size(type);
+  if ((r->chunk_count + 1) * width > SNBT_CHUNK &&
+      flush_chunk(r) != NBT_WALK_DONE) {
+    return NBT_WALK_STOPPED;
+  }
+  uint8_t *dst = r->chunk + r->chunk_count * width;
+  uint64_t bits = width == 1   ? (uint8_t)value.byte_value
+                  : width == 2 ? (uint16_t)value.short_value
+                  : width == 4 ? (uint32_t)value.int_value
+                               : (uint64_t)value.long_value;
+  for (int i = width - 1; i >= 0; i--) {
+    dst[i] = (uint8_t)bits;
+    bits >>= 8;
+  }
+  r->chunk_count++;
+  return NBT_WALK_DONE;
+}
+
+static int open_container(SnbtReader *r, enum SnbtKind kind,
+                          enum TagType type, const char *name,
+                          uint16_t name_len) {
+  int32_t shape = -1;
+  SnbtShape found = {0, kind == SNBT_ARRAY ? array_element(type) : END};
+  if (kind != SNBT_COMPOUND) {
+    if (!r->emit) {
+      if (r->shape_count == r->shape_capacity) {
+        int32_t capacity = r->shape_capacity ? r->shape_capacity * 2 : 64;
+        SnbtShape *shapes = realloc(r->shapes, capacity * sizeof(SnbtShape));
+        if (shapes == NULL) {
+          printf("Could not allocate memory for SNBT lists\n");
+          return NBT_WALK_ERROR;
+        }
+        r->shapes = shapes;
+        r->shape_capacity = capacity;
+      }
+      shape = r->shape_count++;
+    } else {
+      shape = r->next_shape++;
+      found = r->shapes[shape];
+    }
+  }
+
+  int begin = NBT_CONTINUE;
+  if (loud(r)) {
+    const NBT_Handler *h = r->handler;
+    if (kind == SNBT_COMPOUND && h->begin_compound != NULL) {
+      begin = h->begin_compound(r->ctx, name, name_len);
+    } else if (kind == SNBT_LIST && h->list_begin != NULL) {
+      begin = h->list_begin(r->ctx, name, name_len, found.element_type,
+                            found.length);
+    } else if (kind == SNBT_ARRAY && h->array_begin != NULL) {
+      begin = h->array_begin(r->ctx, name, name_len, type, found.length);
+    }
+  }
+  if (begin != NBT_CONTINUE && begin != NBT_SKIP) {
+    return NBT_WALK_STOPPED;
+  }
+
+  SnbtFrame *f = &r->frames[++r->depth];
+  f->kind = kind;
+  f->element_type = kind == SNBT_ARRAY ? array_element(type) : END;
+  if (r->emit && kind == SNBT_LIST) {
+    f->element_type = found.element_type;
+  }
+  f->count = 0;
+  f->shape = shape;
+  r->chunk_count = 0;
+  if (begin == NBT_SKIP) {
+    r->quiet = r->depth;
+  }
+  return NBT_WALK_DONE;
+}
+
+static int close_container(SnbtReader *r) {
+  SnbtFrame *f = &r->frames[r->depth];
+  if (!r->emit) {
+    if (f->kind != SNBT_COMPOUND) {
+      r->shapes[f->shape].length = f->count;
+      r->shapes[f->shape].element_type = f->element_type;
+    }
+    r->depth--;
+    return NBT_WALK_DONE;
+  }
+
+  int was_loud = loud(r);
+  if (was_loud && r->chunk_count > 0 &&
+      flush_chunk(r) != NBT_WALK_DONE) {
+    return NBT_WALK_STOPPED;
+  }
+  if (r->depth == r->quiet) {
+    r->quiet = SNBT_LOUD;
+  }
+  r->depth--;
+  if (!was_loud) {
+    return NBT_WALK_DONE;
+  }
+  int result = 0;
+  if (f->kind == SNBT_COMPOUND && r->handler->end_compound != NULL) {
+    result = r->handler->end_compound(r->ctx);
+  } else if (f->kind == SNBT_LIST && r->handler->list_end != NULL) {
+    result = r->handler->list_end(r->ctx);
+  }
+  return result != 0 ? NBT_WALK_STOPPED : NBT_WALK_DONE;
+}
+
+// Reads one value at the cursor. Containers are only opened, their
+// contents are read by the loop in read_root. *type is what the value is.
+static int read_value(SnbtReader *r, const char *name, uint16_t name_len,
+                      enum TagType *type) {
+  if (r->pos == r->end) {
+    return snbt_error(r, "Expected a value");
+  }
+  if ((*r->pos == '{' || *r->pos == '[') && r->depth == NBT_MAX_DEPTH) {
+    return snbt_error(r, "Nesting deeper than 512 levels");
+  }
+  if (*r->pos == '{') {
+    r->pos++;
+    *type = COMPOUND;
+    return open_container(r, SNBT_COMPOUND, COMPOUND, name, name_len);
+  }
+  if (*r->pos == '[') {
+    r->pos++;
+    if (r->end - r->pos >= 2 && r->pos[1] == ';') {
+      char c = r->pos[0];
+      *type = c == 'B' ? BYTE_ARRAY : c == 'I' ? INT_ARRAY : LONG_ARRAY;
+      if (c != 'B' && c != 'I' && c != 'L') {
+        return snbt_error(r, "Unknown array type");
+      }
+      r->pos += 2;
+      return open_container(r, SNBT_ARRAY, *type, name, name_len);
+    }
+    *type = LIST;
+    return open_container(r, SNBT_LIST, LIST, name, name_len);
+  }
+
+  const char *s;
+  long len;
+  union NBT_Value value;
+  if (*r->pos == '"' || *r->pos == '\'') {
+    int result = read_quoted(r, 1, &s, &len);
+    if (result != NBT_WALK_DONE) {
+      return result;
+    }
+    *type = STRING;
+  } else {
+    s = bare_word(r, &len);
+    if (len == 0) {
+      return snbt_error(r, "Expected a value");
+    }
+    *type = classify(s, len, &value);
+  }
+  if (!loud(r)) {
+    return NBT_WALK_DONE;
+  }
+
+  const NBT_Handler *h = r->handler;
+  int result = 0;
+  if (*type == STRING) {
+    if (h->string != NULL) {
+      result = h->string(r->ctx, name, name_len, s, (uint16_t)len);
+    }
+  } else if (r->depth > 0 && r->frames[r->depth].kind == SNBT_LIST &&
+             h->list_chunk != NULL) {
+    return chunk_number(r, *type, value);
+  } else if (h->scalar != NULL) {
+    result = h->scalar(r->ctx, name, name_len, *type, value);
+  }
+  return result != 0 ? NBT_WALK_STOPPED : NBT_WALK_DONE;
+}
+
+// Array elements are integers of the array's type, unsuffixed ones are
+// taken as long as they fit
+static int read_element(SnbtReader *r, SnbtFrame *f) {
+  long len;
+  const char *start = r->pos;
+  const char *s = bare_word(r, &len);
+  union NBT_Value value;
+  enum TagType type = len > 0 ? classify(s, len, &value) : STRING;
+  if (type == INT && f->element_type != INT) {
+    int64_t v = value.int_value;
+    if (f->element_type == LONG) {
+      value.long_value = v;
+      type = LONG;
+    } else if (v >= INT8_MIN && v <= INT8_MAX) {
+      value.byte_value = (int8_t)v;
+      type = BYTE;
+    }
+  }
+  if (type != f->element_type) {
+    r->pos = start;
+    return snbt_error(r, f->element_type == BYTE  ? "Expected a byte"
+                         : f->element_type == INT ? "Expected an int"
+                                                  : "Expected a long");
+  }
+  return loud(r) ? chunk_number(r, type, value) : NBT_WALK_DONE;
+}
+
+// One root value with everything in it, iteratively over the frame stack
+static int read_root(SnbtReader *r) {
+  enum TagType type;
+  int result = read_value(r, "", 0, &type);
+  while (result == NBT_WALK_DONE && r->depth > 0) {
+    SnbtFrame *f = &r->frames[r->depth];
+    char close = f->kind == SNBT_COMPOUND ? '}' : ']';
+    if (expect(r, close)) {
+      r->pos++;
+      result = close_container(r);
+      continue;
+    }
+    if (f->count > 0) {
+      if (!expect(r, ',')) {
+        return snbt_error(r, close == '}' ? "Expected ',' or '}'"
+                                          : "Expected ',' or ']'");
+      }
+      r->pos++;
+    }
+    skip_space(r);
+    f->count++;
+
+    if (f->kind == SNBT_ARRAY) {
+      result = read_element(r, f);
+    } else if (f->kind == SNBT_LIST) {
+      const char *start = r->pos;
+      result = read_value(r, NULL, 0, &type);
+      if (result == NBT_WALK_DONE && !r->emit) {
+        if (f->count == 1) {
+          f->element_type = type;
+        } else if (type != f->element_type) {
+          r->pos = start;
+          return snbt_error(r, "List elements of different types");
+        }
+      }
+    } else {
+      const char *key;
+      long key_len;
+      if (r->pos < r->end && (*r->pos == '"' || *r->pos == '\'')) {
+        result = read_quoted(r, 0, &key, &key_len);
+        if (result != NBT_WALK_DONE) {
+          return result;
+        }
+      } else {
+        key = bare_word(r, &key_len);
+        if (key_len == 0) {
+          return snbt_error(r, "Expected a key");
+        }
+      }
+      if (!expect(r, ':')) {
+        return snbt_error(r, "Expected ':'");
+      }
+      r->pos++;
+      skip_space(r);
+      result = read_value(r, key, (uint16_t)key_len, &type);
+    }
+  }
+  return result;
+}
+
+static int read_pass(SnbtReader *r) {
+  r->pos = r->text;
+  r->depth = 0;
+  r->quiet = SNBT_LOUD;
+  r->next_shape = 0;
+  r->chunk_count = 0;
+  while (1) {
+    skip_space(r);
+    if (r->pos == r->end) {
+      return NBT_WALK_DONE;
+    }
+    int result = read_root(r);
+    if (result != NBT_WALK_DONE) {
+      return result;
+    }
+  }
+}
+
+int snbt_walk(const char *text, long len, const NBT_Handler *handler,
+              void *ctx) {
+  SnbtReader *r = malloc(sizeof(SnbtReader));
+  if (r == NULL) {
+    printf("Could not allocate memory for SNBT reader\n");
+    return NBT_WALK_ERROR;
+  }
+  r->text = text;
+  r->end = text + len;
+  r->emit = 0;
+  r->handler = handler;
+  r->ctx = ctx;
+  r->shapes = NULL;
+  r->shape_count = 0;
+  r->shape_capacity = 0;
+  r->scratch = NULL;
+
+  int result = read_pass(r);
+  if (result == NBT_WALK_DONE) {
+    r->emit = 1;
+    result = read_pass(r);
+  }
+  free(r->shapes);
+  free(r->scratch);
+  free(r);
+  return result;
+}
+
+long snbt_to_nbt(const char *text, long len, uint8_t **out_buffer) {
+  NBT_Output out;
+  if (output_init_memory(&out, len) != 0) {
+    return -1;
+  }
+  NBT_Writer w;
+  init_writer(&w, &out);
+  int result = snbt_walk(text, len, &write_handler, &w);
+  size_t size;
+  char *data = output_take(&out, &size);
+  if (result != NBT_WALK_DONE || out.failed) {
+    free(data);
+    return -1;
+  }
+  *out_buffer = (uint8_t *)data;
+  return (long)size;
+}
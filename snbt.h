@@ -0,0 +1,47 @@
+#ifndef NBT_SNBT_H
+#define NBT_SNBT_H
+
+#include "events.h"
+#include "output.h"
+#include "parser.h"
+
+// Stringified NBT, the text form used in commands and data packs:
+// {Count:1b,id:"minecraft:stone",Pos:[0.5d,64.0d,-3.5d]}. Every root tag is
+// written on a line of its own and without its name.
+
+// Appends tag as SNBT. Lazy compounds and lists of doc are decoded on the
+// way. Returns 0, or -1 if the output could not grow or a lazy payload
+// turned out to be malformed.
+int snbt_write_tag(NBT_Output *out, NBT_Document *doc, NBT_Tag *tag);
+
+typedef struct NBT_SnbtWriter {
+  NBT_Output *out;
+  int depth;
+  // the open container at each depth is a list, its elements have no key
+  uint8_t in_list[NBT_MAX_DEPTH + 2];
+  // values written so far in the open container at each depth
+  int32_t count[NBT_MAX_DEPTH + 2];
+  // element type of the array or packed list whose chunks are arriving,
+  // and how many elements of the array are still to come
+  enum TagType chunk_type;
+  int32_t array_remaining;
+} NBT_SnbtWriter;
+
+// Handler that writes the events it is fed as SNBT
+extern const NBT_Handler snbt_handler;
+void init_snbt_writer(NBT_SnbtWriter *w, NBT_Output *out);
+
+// Feeds the values of SNBT text to handler, the way nbt_walk does for
+// binary NBT. Several root values may follow each other, root tags get an
+// empty name. Lists of numbers go through list_chunk when the handler has
+// one, and arrays through array_chunk, as big-endian elements. Names,
+// strings and chunks are only valid until the callback returns. The text
+// is checked as a whole before the first callback, so a malformed one
+// makes no calls. Returns one of NBT_WalkResult.
+int snbt_walk(const char *text, long len, const NBT_Handler *handler,
+              void *ctx);
+// Converts SNBT text to binary NBT in a new heap buffer and returns its
+// size, or -1
+long snbt_to_nbt(const char *text, long len, uint8_t **out_buffer);
+
+#endif // NBT_SNBT_H
@@ -0,0 +1,212 @@
+#include "threadpool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Remaining tasks [next, end) of one worker. The owner takes from the front,
+// thieves split off the back. Each queue sits on its own cache line so
+// workers do not slow each other down while taking tasks.
+typedef struct PoolQueue {
+  _Alignas(64) pthread_mutex_t lock;
+  long next;
+  long end;
+} PoolQueue;
+
+typedef struct PoolWorker {
+  NBT_Pool *pool;
+  int index;
+} PoolWorker;
+
+struct NBT_Pool {
+  int size;
+  PoolQueue *queues;
+  PoolWorker *workers;
+  pthread_t *threads;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  // bumped for every pool_run, helpers wait for it to change
+  unsigned long generation;
+  // helpers that have not finished the current run yet
+  int running;
+  int shutdown;
+  NBT_TaskFn fn;
+  void *ctx;
+};
+
+static int take_task(PoolQueue *queue, long *task) {
+  int found = 0;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->next < queue->end) {
+    *task = queue->next++;
+    found = 1;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return found;
+}
+
+// Moves the back half of the first non-empty queue after the thief's own to
+// the thief. Returns 0 once every queue is empty.
+static int steal_tasks(NBT_Pool *pool, int thief) {
+  for (int i = 1; i < pool->size; i++) {
+    PoolQueue *victim = &pool->queues[(thief + i) % pool->size];
+    pthread_mutex_lock(&victim->lock);
+    long remaining = victim->end - victim->next;
+    if (remaining <= 0) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+    long end = victim->end;
+    long start = end - (remaining + 1) / 2;
+    victim->end = start;
+    pthread_mutex_unlock(&victim->lock);
+
+    PoolQueue *own = &pool->queues[thief];
+    pthread_mutex_lock(&own->lock);
+    own->next = start;
+    own->end = end;
+    pthread_mutex_unlock(&own->lock);
+    return 1;
+  }
+  return 0;
+}
+
+static void work(NBT_Pool *pool, int index) {
+  PoolQueue *own = &pool->queues[index];
+  long task;
+  do {
+    while (take_task(own, &task)) {
+      pool->fn(pool->ctx, index, task);
+    }
+  } while (steal_tasks(pool, index));
+}
+
+static void *helper_main(void *arg) {
+  PoolWorker *worker = arg;
+  NBT_Pool *pool = worker->pool;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->shutdown && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->shutdown) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    work(pool, worker->index);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+NBT_Pool *create_pool(int threads) {
+  if (threads <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (int)cpus : 1;
+  }
+
+  NBT_Pool *pool = calloc(1, sizeof(NBT_Pool));
+  if (pool == NULL) {
+    printf("Could not allocate memory for thread pool\n");
+    return NULL;
+  }
+  pool->size = threads;
+  pool->workers = malloc(threads * sizeof(PoolWorker));
+  pool->threads = malloc(threads * sizeof(pthread_t));
+  if (posix_memalign((void **)&pool->queues, 64,
+                     threads * sizeof(PoolQueue)) != 0) {
+    pool->queues = NULL;
+  }
+  if (pool->workers == NULL || pool->threads == NULL || pool->queues == NULL) {
+    printf("Could not allocate memory for thread pool\n");
+    free(pool->workers);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (int i = 0; i < threads; i++) {
+    pthread_mutex_init(&pool->queues[i].lock, NULL);
+    pool->queues[i].next = 0;
+    pool->queues[i].end = 0;
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+  }
+
+  // the caller of pool_run is worker 0, only the others get a thread
+  for (int i = 1; i < threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, helper_main,
+                       &pool->workers[i]) != 0) {
+      printf("Could not start worker thread %d\n", i);
+      // run with the threads that did start
+      pool->size = i;
+      break;
+    }
+  }
+  return pool;
+}
+
+int pool_size(const NBT_Pool *pool) { return pool->size; }
+
+void pool_run(NBT_Pool *pool, long tasks, NBT_TaskFn fn, void *ctx) {
+  // contiguous ranges keep neighbouring tasks on the same worker
+  for (int i = 0; i < pool->size; i++) {
+    pool->queues[i].next = tasks * i / pool->size;
+    pool->queues[i].end = tasks * (i + 1) / pool->size;
+  }
+  pool->fn = fn;
+  pool->ctx = ctx;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->generation++;
+  pool->running = pool->size - 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  work(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->running > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void destroy_pool(NBT_Pool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 1; i < pool->size; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+  for (int i = 0; i < pool->size; i++) {
+    pthread_mutex_destroy(&pool->queues[i].lock);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->workers);
+  free(pool->threads);
+  free(pool->queues);
+  free(pool);
+}
@@ -0,0 +1,21 @@
+#ifndef NBT_THREADPOOL_H
+#define NBT_THREADPOOL_H
+
+// Runs fn once for every task index, worker is the index of the thread
+// running it (0 .. pool_size - 1) so callers can keep per-worker state
+typedef void (*NBT_TaskFn)(void *ctx, int worker, long task);
+
+// Fixed set of threads sharing tasks by work stealing. Every worker starts
+// with a contiguous range of task indices and idle workers steal half of
+// the remaining range of another one.
+typedef struct NBT_Pool NBT_Pool;
+
+// threads <= 0 uses one thread per online CPU
+NBT_Pool *create_pool(int threads);
+int pool_size(const NBT_Pool *pool);
+// Runs tasks 0 .. tasks - 1 and returns once all of them are done. The
+// calling thread takes part as worker 0.
+void pool_run(NBT_Pool *pool, long tasks, NBT_TaskFn fn, void *ctx);
+void destroy_pool(NBT_Pool *pool);
+
+#endif // NBT_THREADPOOL_H
@@ -0,0 +1,325 @@
+#include "writer.h"
+#include "bswap.h"
+#include "cursor.h"
+#include "file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// Fixed-size fields are reserved and stored in one go. A failed reserve
+// marks the output failed, which the callers report at the end.
+static void put_u8(NBT_Output *out, uint8_t v) { output_char(out, v); }
+
+static void put_be16(NBT_Output *out, uint16_t v) {
+  char *dst = output_reserve(out, 2);
+  if (dst != NULL) {
+    v = NBT_BE16(v);
+    memcpy(dst, &v, 2);
+    out->len += 2;
+  }
+}
+
+static void put_be32(NBT_Output *out, uint32_t v) {
+  char *dst = output_reserve(out, 4);
+  if (dst != NULL) {
+    v = NBT_BE32(v);
+    memcpy(dst, &v, 4);
+    out->len += 4;
+  }
+}
+
+static void put_be64(NBT_Output *out, uint64_t v) {
+  char *dst = output_reserve(out, 8);
+  if (dst != NULL) {
+    v = NBT_BE64(v);
+    memcpy(dst, &v, 8);
+    out->len += 8;
+  }
+}
+
+static void put_header(NBT_Output *out, enum TagType type, const char *name,
+                       uint16_t name_len) {
+  char *dst = output_reserve(out, 3 + name_len);
+  if (dst != NULL) {
+    uint16_t len = NBT_BE16(name_len);
+    dst[0] = type;
+    memcpy(dst + 1, &len, 2);
+    memcpy(dst + 3, name, name_len);
+    out->len += 3 + name_len;
+  }
+}
+
+static void put_scalar(NBT_Output *out, enum TagType type,
+                       union NBT_Value value) {
+  uint32_t bits32;
+  uint64_t bits64;
+  switch (type) {
+  case BYTE:
+    put_u8(out, value.byte_value);
+    break;
+  case SHORT:
+    put_be16(out, value.short_value);
+    break;
+  case INT:
+    put_be32(out, value.int_value);
+    break;
+  case LONG:
+    put_be64(out, value.long_value);
+    break;
+  case FLOAT:
+    memcpy(&bits32, &value.float_value, 4);
+    put_be32(out, bits32);
+    break;
+  default:
+    memcpy(&bits64, &value.double_value, 8);
+    put_be64(out, bits64);
+    break;
+  }
+}
+
+static void put_string(NBT_Output *out, const char *value,
+                       uint16_t value_len) {
+  put_be16(out, value_len);
+  output_write(out, value, value_len);
+}
+
+// Elements of an array or packed list, wider numbers are swapped in bulk
+// straight into the output
+static void put_numbers(NBT_Output *out, enum TagType type, const void *data,
+                        int32_t length) {
+  if (length == 0) {
+    return;
+  }
+  size_t width = number_size(type);
+  if (width == 1) {
+    output_write(out, data, length);
+    return;
+  }
+  char *dst = output_reserve(out, length * width);
+  if (dst == NULL) {
+    return;
+  }
+  if (width == 2) {
+    bswap16_encode((uint8_t *)dst, data, length);
+  } else if (width == 4) {
+    bswap32_encode((uint8_t *)dst, data, length);
+  } else {
+    bswap64_encode((uint8_t *)dst, data, length);
+  }
+  out->len += length * width;
+}
+
+static void put_array(NBT_Output *out, enum TagType type, const void *data,
+                      int32_t length) {
+  enum TagType element =
+      type == BYTE_ARRAY ? BYTE : type == INT_ARRAY ? INT : LONG;
+  put_be32(out, length);
+  put_numbers(out, element, data, length);
+}
+
+static int write_payload(NBT_Output *out, NBT_Document *doc, NBT_Tag *tag) {
+  union NBT_Value *value = &tag->value;
+  int32_t length;
+  NBT_Tag *elements;
+
+  switch (tag->tag_type) {
+  case BYTE:
+  case SHORT:
+  case INT:
+  case LONG:
+  case FLOAT:
+  case DOUBLE:
+    put_scalar(out, tag->tag_type, *value);
+    return 0;
+  case STRING:
+    put_string(out, value->string_value.data, value->string_value.length);
+    return 0;
+  case BYTE_ARRAY:
+    put_array(out, BYTE_ARRAY, value->byte_array.data,
+              value->byte_array.length);
+    return 0;
+  case INT_ARRAY:
+    put_array(out, INT_ARRAY, value->int_array.data, value->int_array.length);
+    return 0;
+  case LONG_ARRAY:
+    put_array(out, LONG_ARRAY, value->long_array.data,
+              value->long_array.length);
+    return 0;
+  case LIST:
+    if (number_size(value->list_value.element_type) != 0) {
+      put_u8(out, value->list_value.element_type);
+      put_be32(out, value->list_value.length);
+      put_numbers(out, value->list_value.element_type,
+                  value->list_value.values, value->list_value.length);
+      return 0;
+    }
+    elements = tag_elements(doc, tag, &length);
+    if (length < 0) {
+      return -1;
+    }
+    put_u8(out, value->list_value.element_type);
+    put_be32(out, length);
+    for (int32_t i = 0; i < length; i++) {
+      if (write_payload(out, doc, &elements[i]) != 0) {
+        return -1;
+      }
+    }
+    return 0;
+  case COMPOUND:
+    elements = tag_elements(doc, tag, &length);
+    if (length < 0) {
+      return -1;
+    }
+    for (int32_t i = 0; i < length; i++) {
+      NBT_Tag *child = &elements[i];
+      put_header(out, child->tag_type, child->name, child->name_length);
+      if (write_payload(out, doc, child) != 0) {
+        return -1;
+      }
+    }
+    put_u8(out, END);
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+int write_tag(NBT_Output *out, NBT_Document *doc, NBT_Tag *tag) {
+  put_header(out, tag->tag_type, tag->name, tag->name_length);
+  if (write_payload(out, doc, tag) != 0) {
+    printf("Could not encode malformed tag\n");
+    return -1;
+  }
+  return out->failed ? -1 : 0;
+}
+
+// Named tags get their header, list elements only their payload
+static void write_named(NBT_Writer *w, enum TagType type, const char *name,
+                        uint16_t name_len) {
+  if (!w->in_list[w->depth]) {
+    put_header(w->out, type, name, name_len);
+  }
+}
+
+static int write_begin_compound(void *ctx, const char *name,
+                                uint16_t name_len) {
+  NBT_Writer *w = ctx;
+  write_named(w, COMPOUND, name, name_len);
+  w->in_list[++w->depth] = 0;
+  return w->out->failed;
+}
+
+static int write_end_compound(void *ctx) {
+  NBT_Writer *w = ctx;
+  put_u8(w->out, END);
+  w->depth--;
+  return w->out->failed;
+}
+
+static int write_scalar(void *ctx, const char *name, uint16_t name_len,
+                        enum TagType type, union NBT_Value value) {
+  NBT_Writer *w = ctx;
+  write_named(w, type, name, name_len);
+  put_scalar(w->out, type, value);
+  return w->out->failed;
+}
+
+static int write_string(void *ctx, const char *name, uint16_t name_len,
+                        const char *value, uint16_t value_len) {
+  NBT_Writer *w = ctx;
+  write_named(w, STRING, name, name_len);
+  put_string(w->out, value, value_len);
+  return w->out->failed;
+}
+
+static int write_array_begin(void *ctx, const char *name, uint16_t name_len,
+                             enum TagType type, int32_t length) {
+  NBT_Writer *w = ctx;
+  write_named(w, type, name, name_len);
+  put_be32(w->out, length);
+  w->array_width = type == BYTE_ARRAY ? 1 : type == INT_ARRAY ? 4 : 8;
+  return w->out->failed;
+}
+
+// chunks of arrays and packed lists are still big-endian, they are copied as
+// they are
+static int write_array_chunk(void *ctx, const uint8_t *data, int32_t count) {
+  NBT_Writer *w = ctx;
+  output_write(w->out, (const char *)data, (size_t)count * w->array_width);
+  return w->out->failed;
+}
+
+static int write_list_begin(void *ctx, const char *name, uint16_t name_len,
+                            enum TagType element_type, int32_t length) {
+  NBT_Writer *w = ctx;
+  write_named(w, LIST, name, name_len);
+  put_u8(w->out, element_type);
+  put_be32(w->out, length);
+  w->array_width = number_size(element_type);
+  w->in_list[++w->depth] = 1;
+  return w->out->failed;
+}
+
+static int write_list_end(void *ctx) {
+  NBT_Writer *w = ctx;
+  w->depth--;
+  return 0;
+}
+
+const NBT_Handler write_handler = {
+    .begin_compound = write_begin_compound,
+    .end_compound = write_end_compound,
+    .scalar = write_scalar,
+    .string = write_string,
+    .array_begin = write_array_begin,
+    .array_chunk = write_array_chunk,
+    .list_begin = write_list_begin,
+    .list_chunk = write_array_chunk,
+    .list_end = write_list_end,
+};
+
+void init_writer(NBT_Writer *w, NBT_Output *out) {
+  w->out = out;
+  w->depth = 0;
+  w->in_list[0] = 0;
+  w->array_width = 1;
+}
+
+int write_compressed(const char *filename, const uint8_t *data, long size,
+                     enum NBT_Compression compression, NBT_Pool *pool) {
+  if (compression == NBT_COMPRESS_NONE) {
+    return write_file(filename, data, size);
+  }
+  uint8_t *compressed;
+  long compressed_size = compress_parallel(
+      pool, data, size, compression == NBT_COMPRESS_GZIP ? 15 + 16 : 15,
+      Z_DEFAULT_COMPRESSION, &compressed);
+  if (compressed_size < 0) {
+    return -1;
+  }
+  int result = write_file(filename, compressed, compressed_size);
+  free(compressed);
+  return result;
+}
+
+int save_document(const char *filename, NBT_Document *doc,
+                  enum NBT_Compression compression, NBT_Pool *pool) {
+  if (doc->root == NULL) {
+    printf("No tag to write to %s\n", filename);
+    return -1;
+  }
+  NBT_Output out;
+  if (output_init_memory(&out, 0) != 0) {
+    return -1;
+  }
+  int result = write_tag(&out, doc, doc->root);
+  size_t len;
+  char *data = output_take(&out, &len);
+  if (result == 0) {
+    result = write_compressed(filename, (const uint8_t *)data, len,
+                              compression, pool);
+  }
+  free(data);
+  return result;
+}
@@ -0,0 +1,47 @@
+#ifndef NBT_WRITER_H
+#define NBT_WRITER_H
+
+#include "events.h"
+#include "output.h"
+#include "parser.h"
+#include "threadpool.h"
+
+// Encodes trees and event streams back into NBT. Everything is appended to
+// an NBT_Output, so a whole document ends up in one growing buffer, or goes
+// out in large writes when the output is bound to a file descriptor.
+
+enum NBT_Compression {
+  NBT_COMPRESS_NONE,
+  NBT_COMPRESS_GZIP,
+  NBT_COMPRESS_ZLIB,
+};
+
+// Appends tag with its type, name and payload. Lazy compounds and lists of
+// doc are decoded on the way. Returns 0, or -1 if the output could not grow
+// or a lazy payload turned out to be malformed.
+int write_tag(NBT_Output *out, NBT_Document *doc, NBT_Tag *tag);
+
+typedef struct NBT_Writer {
+  NBT_Output *out;
+  int depth;
+  // the open container at each depth is a list, its elements have no header
+  uint8_t in_list[NBT_MAX_DEPTH + 2];
+  // element size of the array or packed list whose chunks are arriving
+  int array_width;
+} NBT_Writer;
+
+// Handler that writes the events it is fed back as NBT, walking a buffer
+// through it reproduces the buffer. Check out->failed once the walk is done.
+extern const NBT_Handler write_handler;
+void init_writer(NBT_Writer *w, NBT_Output *out);
+
+// Compresses data as asked and replaces the contents of filename with it.
+// Large inputs are compressed in blocks on pool, which may be NULL.
+int write_compressed(const char *filename, const uint8_t *data, long size,
+                     enum NBT_Compression compression, NBT_Pool *pool);
+// Encodes the root tag of doc and writes it to filename, fails when doc has
+// none (an empty input)
+int save_document(const char *filename, NBT_Document *doc,
+                  enum NBT_Compression compression, NBT_Pool *pool);
+
+#endif // NBT_WRITER_H